@@ -0,0 +1,242 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* Offline benchmark of Gismeteo page parsers */
+
+// Usage: gismeteo-benchmark [-n iterations] <corpus>
+//
+// Corpus directory holds recorded pages in daily/*.html and search/*.html.
+// Every parser backend runs over every page, results are printed as one
+// JSON object per line to stdout.
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QStringList>
+
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include "gismeteo_parser.h"
+#include "gismeteo_querycache.h"
+#include "gismeteo_streamparser.h"
+
+#ifndef GISMETEO_SOURCE_DIR
+#define GISMETEO_SOURCE_DIR "."
+#endif
+
+// Count heap allocations made through operator new. Qt containers and
+// strings go through it, libxml2 uses malloc directly and isn't counted.
+// Blocks carry their size, so bytes in use are known too. Parsing runs
+// in this thread only, plain counters are enough.
+static qint64 s_allocations;
+static qint64 s_allocatedBytes;
+static qint64 s_liveBytes;
+static qint64 s_peakLiveBytes;
+
+// Dynamic exception specifications are gone since C++17
+#if __cplusplus < 201103L
+#define GISMETEO_THROWS_BAD_ALLOC throw(std::bad_alloc)
+#define GISMETEO_NOTHROW throw()
+#else
+#define GISMETEO_THROWS_BAD_ALLOC
+#define GISMETEO_NOTHROW noexcept
+#endif
+
+// Keeps malloc alignment of the block after the size
+static const size_t headerSize = 16;
+
+void *operator new(size_t size) GISMETEO_THROWS_BAD_ALLOC
+{
+    char *p = static_cast<char *>(malloc(size + headerSize));
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    *reinterpret_cast<size_t *>(p) = size;
+
+    ++s_allocations;
+    s_allocatedBytes += size;
+    s_liveBytes += size;
+    s_peakLiveBytes = qMax(s_peakLiveBytes, s_liveBytes);
+    return p + headerSize;
+}
+
+void *operator new[](size_t size) GISMETEO_THROWS_BAD_ALLOC
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) GISMETEO_NOTHROW
+{
+    if (!p) {
+        return;
+    }
+    char *block = static_cast<char *>(p) - headerSize;
+    s_liveBytes -= *reinterpret_cast<size_t *>(block);
+    free(block);
+}
+
+void operator delete[](void *p) GISMETEO_NOTHROW
+{
+    operator delete(p);
+}
+
+// Peak resident set size of the process, in kilobytes on Linux. Unlike
+// heap counters it includes libxml2 memory.
+static long peakRss()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static QList<QByteArray> loadPages(const QString &path)
+{
+    QList<QByteArray> pages;
+
+    const QDir dir(path);
+    foreach (const QString &name, dir.entryList(QStringList() << "*.html", QDir::Files, QDir::Name)) {
+        QFile file(dir.filePath(name));
+        if (file.open(QIODevice::ReadOnly)) {
+            pages.append(file.readAll());
+        }
+    }
+    return pages;
+}
+
+enum Backend {
+    DailyXQuery,
+    DailyStream,
+    SearchXQuery
+};
+
+static bool parse(Backend backend, const GismeteoCompiledQuery &query, const QByteArray &page)
+{
+    switch (backend) {
+    case DailyXQuery: {
+        WeatherData data;
+        return GismeteoParser::readHTMLData(query.query, query.elementIds, page, data);
+    }
+    case DailyStream: {
+        GismeteoStreamParser parser;
+        parser.feed(page);
+        parser.finish();
+        return parser.isValid();
+    }
+    case SearchXQuery: {
+        QList<XMLMapInfo> places;
+        return GismeteoParser::readSearchHTMLData(query.query, query.elementIds, page, places);
+    }
+    }
+    return false;
+}
+
+static void run(const char *benchmark, const char *backendName, Backend backend,
+                const GismeteoCompiledQuery &query, const QList<QByteArray> &pages, int iterations)
+{
+    if (pages.isEmpty()) {
+        return;
+    }
+
+    qint64 bytes = 0;
+    foreach (const QByteArray &page, pages) {
+        bytes += page.size();
+    }
+
+    // Warm up, first run pays for lazy initialisation
+    parse(backend, query, pages.first());
+
+    int failures = 0;
+    const qint64 allocationsBefore = s_allocations;
+    const qint64 bytesBefore = s_allocatedBytes;
+    const qint64 liveBefore = s_liveBytes;
+    s_peakLiveBytes = s_liveBytes;
+    const long rssBefore = peakRss();
+    QElapsedTimer timer;
+    timer.start();
+
+    for (int i = 0; i < iterations; ++i) {
+        foreach (const QByteArray &page, pages) {
+            if (!parse(backend, query, page)) {
+                ++failures;
+            }
+        }
+    }
+
+    const double seconds = timer.nsecsElapsed() / 1e9;
+    const long rssAfter = peakRss();
+    const double allocations = s_allocations - allocationsBefore;
+    const double allocatedBytes = s_allocatedBytes - bytesBefore;
+    const qint64 totalPages = qint64(pages.size()) * iterations;
+
+    printf("{\"benchmark\": \"%s\", \"backend\": \"%s\", \"pages\": %lld, \"bytes\": %lld, "
+           "\"seconds\": %.6f, \"pages_per_sec\": %.2f, \"bytes_per_sec\": %.0f, "
+           "\"allocations_per_page\": %.1f, \"allocated_bytes_per_page\": %.0f, "
+           "\"peak_heap_bytes\": %lld, \"peak_rss_kb\": %ld, \"peak_rss_growth_kb\": %ld, "
+           "\"failures\": %d}\n",
+           benchmark, backendName, totalPages, bytes * iterations,
+           seconds, totalPages / seconds, bytes * iterations / seconds,
+           allocations / totalPages, allocatedBytes / totalPages,
+           s_peakLiveBytes - liveBefore, rssAfter, rssAfter - rssBefore, failures);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QStringList args = app.arguments();
+    args.removeFirst();
+
+    int iterations = 10;
+    if (args.size() >= 2 && args.first() == "-n") {
+        iterations = qMax(1, args.at(1).toInt());
+        args = args.mid(2);
+    }
+
+    if (args.size() != 1) {
+        fprintf(stderr, "Usage: gismeteo-benchmark [-n iterations] <corpus>\n");
+        return 1;
+    }
+
+    const QDir corpus(args.first());
+    const QList<QByteArray> dailyPages = loadPages(corpus.filePath("daily"));
+    const QList<QByteArray> searchPages = loadPages(corpus.filePath("search"));
+    if (dailyPages.isEmpty() && searchPages.isEmpty()) {
+        fprintf(stderr, "No pages found in %s/daily and %s/search\n",
+                qPrintable(corpus.path()), qPrintable(corpus.path()));
+        return 1;
+    }
+
+    GismeteoQueryCache queryCache;
+    const GismeteoCompiledQuery dailyQuery = queryCache.query(GISMETEO_SOURCE_DIR "/gismeteo.xq");
+    const GismeteoCompiledQuery searchQuery = queryCache.query(GISMETEO_SOURCE_DIR "/gismeteo-search.xq");
+
+    // Peak heap is measured from what was in use before each run. Peak RSS
+    // only grows, so lighter backends go first and growth is what a run
+    // added over the ones before it.
+    run("daily", "stream", DailyStream, dailyQuery, dailyPages, iterations);
+    run("daily", "xquery", DailyXQuery, dailyQuery, dailyPages, iterations);
+    run("search", "xquery", SearchXQuery, searchQuery, searchPages, iterations);
+
+    return 0;
+}
@@ -0,0 +1,147 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* Bounded LRU cache with time to live */
+
+#ifndef GISMETEO_CACHE_H
+#define GISMETEO_CACHE_H
+
+#include <QDateTime>
+#include <QHash>
+#include <QLinkedList>
+
+// Keeps at most maxEntries values, evicting least recently used ones.
+// Values older than time to live are stale: still returned, but callers
+// are expected to refresh them.
+template <class Key, class T>
+class GismeteoCache
+{
+
+public:
+    GismeteoCache(int maxEntries, int timeToLive)
+        : m_maxEntries(maxEntries), m_timeToLive(timeToLive)
+    {
+    }
+
+    // Limits, time to live is in seconds
+    void setMaxEntries(int maxEntries)
+    {
+        m_maxEntries = qMax(1, maxEntries);
+        trim();
+    }
+
+    void setTimeToLive(int timeToLive)
+    {
+        m_timeToLive = timeToLive;
+    }
+
+    bool contains(const Key &key) const
+    {
+        return m_entries.contains(key);
+    }
+
+    // Returns value marking it as recently used, 0 if there is none
+    T *object(const Key &key)
+    {
+        typename QHash<Key, Entry>::iterator it = m_entries.find(key);
+        if (it == m_entries.end()) {
+            return 0;
+        }
+
+        m_order.erase(it.value().order);
+        it.value().order = m_order.insert(m_order.begin(), key);
+        return &it.value().value;
+    }
+
+    T value(const Key &key)
+    {
+        const T *found = object(key);
+        return found ? *found : T();
+    }
+
+    // Value is present and not older than time to live
+    bool isFresh(const Key &key) const
+    {
+        typename QHash<Key, Entry>::const_iterator it = m_entries.constFind(key);
+        return it != m_entries.constEnd() &&
+               it.value().timestamp + qint64(m_timeToLive) * 1000 > QDateTime::currentMSecsSinceEpoch();
+    }
+
+    // Inserts value, timestamp is when value was obtained
+    void insert(const Key &key, const T &value, qint64 timestamp = QDateTime::currentMSecsSinceEpoch())
+    {
+        typename QHash<Key, Entry>::iterator it = m_entries.find(key);
+        if (it != m_entries.end()) {
+            m_order.erase(it.value().order);
+        } else {
+            it = m_entries.insert(key, Entry());
+        }
+
+        it.value().value = value;
+        it.value().timestamp = timestamp;
+        it.value().order = m_order.insert(m_order.begin(), key);
+
+        trim();
+    }
+
+    void remove(const Key &key)
+    {
+        typename QHash<Key, Entry>::iterator it = m_entries.find(key);
+        if (it != m_entries.end()) {
+            m_order.erase(it.value().order);
+            m_entries.erase(it);
+        }
+    }
+
+    void clear()
+    {
+        m_entries.clear();
+        m_order.clear();
+    }
+
+    int size() const
+    {
+        return m_entries.size();
+    }
+
+private:
+    struct Entry {
+        T value;
+        qint64 timestamp;
+        typename QLinkedList<Key>::iterator order;
+    };
+
+    void trim()
+    {
+        while (m_entries.size() > m_maxEntries) {
+            m_entries.remove(m_order.last());
+            m_order.removeLast();
+        }
+    }
+
+    // Most recently used first
+    QHash<Key, Entry> m_entries;
+    QLinkedList<Key> m_order;
+
+    int m_maxEntries;
+    int m_timeToLive;
+
+};
+
+#endif
@@ -0,0 +1,259 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* Offline catalogue of Gismeteo cities */
+
+#include "gismeteo_catalogue.h"
+
+#include <QFile>
+#include <QSet>
+
+#include <KDebug>
+
+#include "gismeteo_placeindex.h"
+
+GismeteoCatalogue::GismeteoCatalogue()
+{
+}
+
+GismeteoCatalogue::~GismeteoCatalogue()
+{
+    clear();
+}
+
+void GismeteoCatalogue::clear()
+{
+    m_entries.clear();
+    m_data.clear();
+    qDeleteAll(m_files);
+    m_files.clear();
+}
+
+bool GismeteoCatalogue::isEmpty() const
+{
+    return m_entries.isEmpty();
+}
+
+int GismeteoCatalogue::size() const
+{
+    return m_entries.size();
+}
+
+void GismeteoCatalogue::load(const QStringList &fileNames)
+{
+    clear();
+
+    QVector<QPair<QString, Entry> > sorted;
+
+    // Ids listed in files loaded before, local file goes first and its
+    // cities replace the same ones from the bundled file
+    QSet<int> loadedIds;
+
+    foreach (const QString &fileName, fileNames) {
+        QFile *file = new QFile(fileName);
+        const uchar *data = 0;
+        if (file->open(QIODevice::ReadOnly)) {
+            data = file->map(0, file->size());
+        }
+        if (!data) {
+            kDebug() << "Can't map city catalogue" << fileName;
+            delete file;
+            continue;
+        }
+
+        const int fileIndex = m_files.size();
+        m_files.append(file);
+        m_data.append(data);
+
+        const char *text = reinterpret_cast<const char *>(data);
+        const qint64 size = file->size();
+        qint64 lineStart = 0;
+        QSet<int> fileIds;
+
+        while (lineStart < size) {
+            qint64 lineEnd = lineStart;
+            while (lineEnd < size && text[lineEnd] != '\n') {
+                ++lineEnd;
+            }
+
+            Entry entry;
+            entry.offset = lineStart;
+            entry.size = qMin<qint64>(lineEnd - lineStart, 0xffff);
+            entry.file = fileIndex;
+
+            // Skip comments, empty and malformed lines
+            if (entry.size > 0 && text[lineStart] != '#') {
+                const Line fields = line(entry);
+                if (fields.id > 0 && !fields.name.isEmpty() && !loadedIds.contains(fields.id)) {
+                    sorted.append(qMakePair(GismeteoPlaceIndex::normalize(fields.name), entry));
+                    fileIds.insert(fields.id);
+                }
+            }
+
+            lineStart = lineEnd + 1;
+        }
+
+        loadedIds.unite(fileIds);
+    }
+
+    qSort(sorted.begin(), sorted.end(), lessThan);
+
+    m_entries.reserve(sorted.size());
+    for (int i = 0; i < sorted.size(); ++i) {
+        m_entries.append(sorted.at(i).second);
+    }
+
+    kDebug() << "Loaded" << m_entries.size() << "cities from" << m_files.size() << "catalogue files";
+}
+
+bool GismeteoCatalogue::lessThan(const QPair<QString, Entry> &a, const QPair<QString, Entry> &b)
+{
+    return a.first < b.first;
+}
+
+GismeteoCatalogue::Line GismeteoCatalogue::line(const Entry &entry) const
+{
+    const char *text = reinterpret_cast<const char *>(m_data.at(entry.file)) + entry.offset;
+    const QStringList fields = QString::fromUtf8(text, entry.size).trimmed().split('\t');
+
+    Line result;
+    result.id = fields.value(0).toInt();
+    result.name = fields.value(1).trimmed();
+    result.region = fields.value(2).trimmed();
+    return result;
+}
+
+QString GismeteoCatalogue::normalizedName(const Entry &entry) const
+{
+    return GismeteoPlaceIndex::normalize(line(entry).name);
+}
+
+XMLMapInfo GismeteoCatalogue::place(const Entry &entry) const
+{
+    const Line fields = line(entry);
+
+    XMLMapInfo place;
+    place.name = fields.region.isEmpty() ? fields.name : fields.name + ", " + fields.region;
+    place.link = QString("/city/daily/%1/").arg(fields.id);
+    place.id = fields.id;
+    return place;
+}
+
+// Optimal string alignment distance, gives up above maxDistance
+int GismeteoCatalogue::distance(const QString &a, const QString &b, int maxDistance)
+{
+    const int n = a.size();
+    const int m = b.size();
+    if (qAbs(n - m) > maxDistance) {
+        return maxDistance + 1;
+    }
+
+    QVector<int> previous2(m + 1), previous(m + 1), current(m + 1);
+    for (int j = 0; j <= m; ++j) {
+        previous[j] = j;
+    }
+
+    for (int i = 1; i <= n; ++i) {
+        current[0] = i;
+        int rowMinimum = current[0];
+
+        for (int j = 1; j <= m; ++j) {
+            const int cost = a.at(i - 1) == b.at(j - 1) ? 0 : 1;
+            int value = qMin(qMin(previous[j] + 1, current[j - 1] + 1), previous[j - 1] + cost);
+            if (i > 1 && j > 1 && a.at(i - 1) == b.at(j - 2) && a.at(i - 2) == b.at(j - 1)) {
+                value = qMin(value, previous2[j - 2] + 1);
+            }
+            current[j] = value;
+            rowMinimum = qMin(rowMinimum, value);
+        }
+
+        if (rowMinimum > maxDistance) {
+            return maxDistance + 1;
+        }
+
+        previous2 = previous;
+        previous = current;
+    }
+
+    return previous[m];
+}
+
+int GismeteoCatalogue::lowerBound(const QString &prefix) const
+{
+    int low = 0;
+    int high = m_entries.size();
+    while (low < high) {
+        const int middle = (low + high) / 2;
+        if (normalizedName(m_entries.at(middle)) < prefix) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+QList<XMLMapInfo> GismeteoCatalogue::find(const QString &query, int limit) const
+{
+    QList<XMLMapInfo> found;
+    const QString prefix = GismeteoPlaceIndex::normalize(query);
+    if (prefix.isEmpty()) {
+        return found;
+    }
+
+    for (int i = lowerBound(prefix); i < m_entries.size() && found.size() < limit; ++i) {
+        if (!normalizedName(m_entries.at(i)).startsWith(prefix)) {
+            break;
+        }
+        found.append(place(m_entries.at(i)));
+    }
+
+    return found;
+}
+
+// Names decoded by one suggestion lookup at most
+static const int maxSuggestScan = 2000;
+
+QList<XMLMapInfo> GismeteoCatalogue::suggest(const QString &query, int limit) const
+{
+    QList<XMLMapInfo> found;
+    const QString prefix = GismeteoPlaceIndex::normalize(query);
+
+    // Short queries must match exactly
+    const int maxDistance = prefix.size() < 4 ? 0 : (prefix.size() < 8 ? 1 : 2);
+    if (maxDistance == 0) {
+        return found;
+    }
+
+    // Names starting with the same letter are next to each other
+    const int first = lowerBound(prefix.left(1));
+    const int last = qMin(m_entries.size(), first + maxSuggestScan);
+
+    for (int i = first; i < last && found.size() < limit; ++i) {
+        const QString name = normalizedName(m_entries.at(i));
+        if (!name.startsWith(prefix.at(0))) {
+            break;
+        }
+        if (distance(prefix, name.left(prefix.size()), maxDistance) <= maxDistance) {
+            found.append(place(m_entries.at(i)));
+        }
+    }
+
+    return found;
+}
@@ -0,0 +1,90 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* Offline catalogue of Gismeteo cities */
+
+#ifndef GISMETEO_CATALOGUE_H
+#define GISMETEO_CATALOGUE_H
+
+#include <QList>
+#include <QPair>
+#include <QStringList>
+#include <QVector>
+
+#include "gismeteo_data.h"
+
+class QFile;
+
+// Cities listed in catalogue files, one per line as tab separated
+// Gismeteo id, name and optional region. Files are memory-mapped, only
+// an array of line locations sorted by normalized name is kept in memory.
+class GismeteoCatalogue
+{
+
+public:
+    GismeteoCatalogue();
+    ~GismeteoCatalogue();
+
+    // Loads catalogue files, dropping ones loaded before. A city listed
+    // in several files is taken from the first one.
+    void load(const QStringList &fileNames);
+    void clear();
+
+    bool isEmpty() const;
+    int size() const;
+
+    // Cities with name starting with the query
+    QList<XMLMapInfo> find(const QString &query, int limit = 50) const;
+
+    // Cities with name prefix differing from the query by a typo or two.
+    // Only names starting with the same letter are looked at, these are
+    // guesses to offer, not answers.
+    QList<XMLMapInfo> suggest(const QString &query, int limit = 10) const;
+
+private:
+    struct Entry {
+        quint32 offset;
+        quint16 size;
+        quint16 file;
+    };
+
+    struct Line {
+        int id;
+        QString name;
+        QString region;
+    };
+
+    static bool lessThan(const QPair<QString, Entry> &a, const QPair<QString, Entry> &b);
+
+    // First entry with normalized name not less than the prefix
+    int lowerBound(const QString &prefix) const;
+
+    Line line(const Entry &entry) const;
+    QString normalizedName(const Entry &entry) const;
+    XMLMapInfo place(const Entry &entry) const;
+
+    static int distance(const QString &a, const QString &b, int maxDistance);
+
+    QList<QFile *> m_files;
+    QList<const uchar *> m_data;
+    QVector<Entry> m_entries;
+
+};
+
+#endif
@@ -0,0 +1,95 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* Buffer of downloaded page chunks */
+
+#include "gismeteo_chunkbuffer.h"
+
+#include <string.h>
+
+// Sizes above this aren't trusted as a hint
+static const qint64 maxSizeHint = 16 * 1024 * 1024;
+
+GismeteoChunkBuffer::GismeteoChunkBuffer()
+    : m_size(0)
+{
+}
+
+void GismeteoChunkBuffer::setSizeHint(qint64 size)
+{
+    if (size <= 0 || size > maxSizeHint || size <= m_size) {
+        return;
+    }
+
+    // Move what we have into the preallocated array, chunks are copied
+    // there from now on
+    m_contiguous.reserve(size);
+    foreach (const QByteArray &chunk, m_chunks) {
+        m_contiguous.append(chunk);
+    }
+    m_chunks.clear();
+}
+
+void GismeteoChunkBuffer::append(const QByteArray &chunk)
+{
+    if (chunk.isEmpty()) {
+        return;
+    }
+
+    if (m_contiguous.capacity() > 0) {
+        m_contiguous.append(chunk);
+    } else {
+        m_chunks.append(chunk);
+    }
+    m_size += chunk.size();
+}
+
+int GismeteoChunkBuffer::size() const
+{
+    return m_size;
+}
+
+bool GismeteoChunkBuffer::isEmpty() const
+{
+    return m_size == 0;
+}
+
+QByteArray GismeteoChunkBuffer::toByteArray() const
+{
+    if (m_chunks.isEmpty()) {
+        return m_contiguous;
+    }
+    if (m_contiguous.isEmpty() && m_chunks.size() == 1) {
+        return m_chunks.first();
+    }
+
+    // Size is known, so the page is allocated once
+    QByteArray page;
+    page.resize(m_size);
+    char *out = page.data();
+    if (!m_contiguous.isEmpty()) {
+        memcpy(out, m_contiguous.constData(), m_contiguous.size());
+        out += m_contiguous.size();
+    }
+    foreach (const QByteArray &chunk, m_chunks) {
+        memcpy(out, chunk.constData(), chunk.size());
+        out += chunk.size();
+    }
+    return page;
+}
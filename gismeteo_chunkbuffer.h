@@ -0,0 +1,57 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* Buffer of downloaded page chunks */
+
+#ifndef GISMETEO_CHUNKBUFFER_H
+#define GISMETEO_CHUNKBUFFER_H
+
+#include <QByteArray>
+#include <QList>
+
+// Collects data of a download without growing one array chunk by chunk.
+// Chunks are kept as they came, sharing data with KIO's arrays, and
+// joined once when a contiguous page is needed. When the size of the
+// page is known upfront, chunks are copied into one preallocated array
+// as they come instead, so nothing is left to join at the end.
+class GismeteoChunkBuffer
+{
+
+public:
+    GismeteoChunkBuffer();
+
+    // Expected size of the whole page, like Content-Length
+    void setSizeHint(qint64 size);
+
+    void append(const QByteArray &chunk);
+
+    int size() const;
+    bool isEmpty() const;
+
+    // Whole page in one array, copies only when there is more than one chunk
+    QByteArray toByteArray() const;
+
+private:
+    QList<QByteArray> m_chunks;
+    QByteArray m_contiguous;    // used once size hint is set
+    int m_size;
+
+};
+
+#endif
@@ -0,0 +1,360 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* Data structures shared by Gismeteo ion and its parsers */
+
+#include "gismeteo_data.h"
+
+// Packed icon layout
+enum {
+    IconValid = 1 << 0,
+    IconNight = 1 << 1,
+    IconCloudsShift = 2,            // 3 bits
+    IconPrecipitationShift = 5,     // 2 bits
+    IconIntensityShift = 7,         // 3 bits
+    IconThunderstorm = 1 << 10
+};
+
+quint16 WeatherIcon::make(bool night, int clouds, Precipitation precipitation, int intensity, bool thunderstorm)
+{
+    return IconValid |
+           (night ? IconNight : 0) |
+           (clouds << IconCloudsShift) |
+           (precipitation << IconPrecipitationShift) |
+           ((precipitation == NoPrecipitation ? 0 : intensity) << IconIntensityShift) |
+           (thunderstorm ? IconThunderstorm : 0);
+}
+
+// Single pass over d.sun[.cN][.rN|.sN][.st].png, path prefix is skipped
+quint16 WeatherIcon::encode(const QString &fileName)
+{
+    const QChar *begin = fileName.constData();
+    const QChar *end = begin + fileName.size();
+    for (const QChar *c = end; c != begin; --c) {
+        if (c[-1] == '/') {
+            begin = c;
+            break;
+        }
+    }
+
+    const QChar *p = begin;
+    const int size = end - begin;
+
+    bool night;
+    if (size >= 9 && p[0] == 'd' && p[1] == '.' && p[2] == 's' && p[3] == 'u' && p[4] == 'n') {
+        night = false;
+        p += 5;
+    } else if (size >= 10 && p[0] == 'n' && p[1] == '.' && p[2] == 'm' && p[3] == 'o' && p[4] == 'o' && p[5] == 'n') {
+        night = true;
+        p += 6;
+    } else {
+        return 0;
+    }
+
+    int clouds = 0;
+    Precipitation precipitation = NoPrecipitation;
+    int intensity = 0;
+    bool thunderstorm = false;
+
+    // Components must come in order, each at most once
+    int stage = 0;
+    while (end - p >= 3 && p[0] == '.') {
+        const ushort kind = p[1].unicode();
+        const ushort level = p[2].unicode();
+
+        if (kind == 'p' && level == 'n' && end - p == 4 && p[3] == 'g') {
+            return make(night, clouds, precipitation, intensity, thunderstorm);
+        }
+        if (kind == 's' && level == 't' && stage < 3) {
+            thunderstorm = true;
+            stage = 3;
+        } else if (level < '1' || level > '4') {
+            return 0;
+        } else if (kind == 'c' && stage < 1) {
+            clouds = level - '0';
+            stage = 1;
+        } else if ((kind == 'r' || kind == 's') && stage < 2) {
+            precipitation = kind == 'r' ? Rain : Snow;
+            intensity = level - '0';
+            stage = 2;
+        } else {
+            return 0;
+        }
+        p += 3;
+    }
+
+    return 0;
+}
+
+enum {
+    CloudLevels = 5,
+    PrecipitationLevels = 9,    // none, rain 1..4, snow 1..4
+    ConditionTextCount = CloudLevels * PrecipitationLevels * 2
+};
+
+static int conditionTextIndex(int clouds, int precipitationIndex, bool thunderstorm)
+{
+    return (clouds * PrecipitationLevels + precipitationIndex) * 2 + (thunderstorm ? 1 : 0);
+}
+
+// Texts by conditionTextIndex(), translated by the caller
+static const char *const conditionTexts[] = {
+    // Clouds 0
+    "Ясно",
+    "Ясно, гроза",
+    "Ясно, небольшой дождь",
+    "Ясно, небольшой дождь, гроза",
+    "Ясно, дождь",
+    "Ясно, дождь, гроза",
+    "Ясно, сильный дождь",
+    "Ясно, сильный дождь, гроза",
+    "Ясно, ливень",
+    "Ясно, ливень, гроза",
+    "Ясно, небольшой снег",
+    "Ясно, небольшой снег, гроза",
+    "Ясно, снег",
+    "Ясно, снег, гроза",
+    "Ясно, сильный снег",
+    "Ясно, сильный снег, гроза",
+    "Ясно, буран",
+    "Ясно, буран, гроза",
+
+    // Clouds 1
+    "Малооблачно",
+    "Малооблачно, гроза",
+    "Малооблачно, небольшой дождь",
+    "Малооблачно, небольшой дождь, гроза",
+    "Малооблачно, дождь",
+    "Малооблачно, дождь, гроза",
+    "Малооблачно, сильный дождь",
+    "Малооблачно, сильный дождь, гроза",
+    "Малооблачно, ливень",
+    "Малооблачно, ливень, гроза",
+    "Малооблачно, небольшой снег",
+    "Малооблачно, небольшой снег, гроза",
+    "Малооблачно, снег",
+    "Малооблачно, снег, гроза",
+    "Малооблачно, сильный снег",
+    "Малооблачно, сильный снег, гроза",
+    "Малооблачно, буран",
+    "Малооблачно, буран, гроза",
+
+    // Clouds 2
+    "Малооблачно",
+    "Малооблачно, гроза",
+    "Малооблачно, небольшой дождь",
+    "Малооблачно, небольшой дождь, гроза",
+    "Малооблачно, дождь",
+    "Малооблачно, дождь, гроза",
+    "Малооблачно, сильный дождь",
+    "Малооблачно, сильный дождь, гроза",
+    "Малооблачно, ливень",
+    "Малооблачно, ливень, гроза",
+    "Малооблачно, небольшой снег",
+    "Малооблачно, небольшой снег, гроза",
+    "Малооблачно, снег",
+    "Малооблачно, снег, гроза",
+    "Малооблачно, сильный снег",
+    "Малооблачно, сильный снег, гроза",
+    "Малооблачно, буран",
+    "Малооблачно, буран, гроза",
+
+    // Clouds 3
+    "Облачно",
+    "Облачно, гроза",
+    "Облачно, небольшой дождь",
+    "Облачно, небольшой дождь, гроза",
+    "Облачно, дождь",
+    "Облачно, дождь, гроза",
+    "Облачно, сильный дождь",
+    "Облачно, сильный дождь, гроза",
+    "Облачно, ливень",
+    "Облачно, ливень, гроза",
+    "Облачно, небольшой снег",
+    "Облачно, небольшой снег, гроза",
+    "Облачно, снег",
+    "Облачно, снег, гроза",
+    "Облачно, сильный снег",
+    "Облачно, сильный снег, гроза",
+    "Облачно, буран",
+    "Облачно, буран, гроза",
+
+    // Clouds 4
+    "Пасмурно",
+    "Пасмурно, гроза",
+    "Пасмурно, небольшой дождь",
+    "Пасмурно, небольшой дождь, гроза",
+    "Пасмурно, дождь",
+    "Пасмурно, дождь, гроза",
+    "Пасмурно, сильный дождь",
+    "Пасмурно, сильный дождь, гроза",
+    "Пасмурно, ливень",
+    "Пасмурно, ливень, гроза",
+    "Пасмурно, небольшой снег",
+    "Пасмурно, небольшой снег, гроза",
+    "Пасмурно, снег",
+    "Пасмурно, снег, гроза",
+    "Пасмурно, сильный снег",
+    "Пасмурно, сильный снег, гроза",
+    "Пасмурно, буран",
+    "Пасмурно, буран, гроза"
+};
+
+// Fails to compile if the table doesn't match conditionTextIndex()
+typedef char ConditionTextsSizeCheck[sizeof(conditionTexts) / sizeof(conditionTexts[0]) == ConditionTextCount ? 1 : -1];
+
+QString WeatherIcon::conditionText(quint16 icon)
+{
+    if (!(icon & IconValid)) {
+        return QString();
+    }
+
+    int precipitationIndex = 0;
+    if (precipitation(icon) == Rain) {
+        precipitationIndex = intensity(icon);
+    } else if (precipitation(icon) == Snow) {
+        precipitationIndex = 4 + intensity(icon);
+    }
+
+    return QString::fromUtf8(conditionTexts[conditionTextIndex(clouds(icon), precipitationIndex, thunderstorm(icon))]);
+}
+
+QString WeatherIcon::fileName(quint16 icon)
+{
+    if (!(icon & IconValid)) {
+        return QString();
+    }
+
+    QString name = isNight(icon) ? "n.moon" : "d.sun";
+    if (clouds(icon)) {
+        name += QString(".c%1").arg(clouds(icon));
+    }
+    if (precipitation(icon) == Rain) {
+        name += QString(".r%1").arg(intensity(icon));
+    } else if (precipitation(icon) == Snow) {
+        name += QString(".s%1").arg(intensity(icon));
+    }
+    if (thunderstorm(icon)) {
+        name += ".st";
+    }
+    return name + ".png";
+}
+
+bool WeatherIcon::isNight(quint16 icon)
+{
+    return icon & IconNight;
+}
+
+int WeatherIcon::clouds(quint16 icon)
+{
+    return (icon >> IconCloudsShift) & 0x7;
+}
+
+WeatherIcon::Precipitation WeatherIcon::precipitation(quint16 icon)
+{
+    return Precipitation((icon >> IconPrecipitationShift) & 0x3);
+}
+
+int WeatherIcon::intensity(quint16 icon)
+{
+    return (icon >> IconIntensityShift) & 0x7;
+}
+
+bool WeatherIcon::thunderstorm(quint16 icon)
+{
+    return icon & IconThunderstorm;
+}
+
+WeatherData::WeatherData()
+    : conditionIcon(0),
+      temperature(NoValue),
+      pressure(NoValue),
+      windDirection(UnknownWind),
+      windSpeed(NoValue),
+      humidity(NoValue),
+      waterTemperature(NoValue),
+      forecastCount(0),
+      hasHourly(false),
+      hourlyCount(0)
+{
+}
+
+bool WeatherData::hasSameValues(const WeatherData &other) const
+{
+    if (date != other.date || condition != other.condition || conditionIcon != other.conditionIcon ||
+        temperature != other.temperature || pressure != other.pressure ||
+        windDirection != other.windDirection || windSpeed != other.windSpeed ||
+        humidity != other.humidity || waterTemperature != other.waterTemperature ||
+        forecastSize() != other.forecastSize() ||
+        hasHourly != other.hasHourly || hourlySize() != other.hourlySize()) {
+        return false;
+    }
+
+    for (int i = 0; i < forecastSize(); ++i) {
+        const Forecast &a = forecasts[i];
+        const Forecast &b = other.forecasts[i];
+        if (a.day != b.day || a.icon != b.icon ||
+            a.temperatureHigh != b.temperatureHigh || a.temperatureLow != b.temperatureLow) {
+            return false;
+        }
+    }
+
+    for (int i = 0; i < hourlySize(); ++i) {
+        const Hourly &a = hourly.at(i);
+        const Hourly &b = other.hourly.at(i);
+        if (a.date != b.date || a.condition != b.condition ||
+            a.temperature != b.temperature || a.pressure != b.pressure ||
+            a.windDirection != b.windDirection || a.windSpeed != b.windSpeed ||
+            a.humidity != b.humidity || a.comfortTemperature != b.comfortTemperature) {
+            return false;
+        }
+    }
+    return true;
+}
+
+WeatherData::Forecast::Forecast()
+    : day(0),
+      icon(0),
+      temperatureHigh(NoValue),
+      temperatureLow(NoValue)
+{
+}
+
+WeatherData::Hourly::Hourly()
+    : temperature(NoValue),
+      pressure(NoValue),
+      windDirection(UnknownWind),
+      windSpeed(NoValue),
+      humidity(NoValue),
+      comfortTemperature(NoValue)
+{
+}
+
+bool isCityCode(const QString &code)
+{
+    if (code.isEmpty() || code.size() > 9) {
+        return false;
+    }
+    for (int i = 0; i < code.size(); ++i) {
+        if (code.at(i) < '0' || code.at(i) > '9') {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,164 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* Data structures shared by Gismeteo ion and its parsers */
+
+#ifndef GISMETEO_DATA_H
+#define GISMETEO_DATA_H
+
+#include <QDateTime>
+#include <QList>
+#include <QtGlobal>
+#include <QMetaType>
+#include <QString>
+#include <QVector>
+
+// Gismeteo condition icon packed from file name like d.sun.c3.r2.st.png,
+// 0 stands for unknown icon
+class WeatherIcon
+{
+
+public:
+    enum Precipitation {
+        NoPrecipitation,
+        Rain,
+        Snow
+    };
+
+    static quint16 encode(const QString &fileName);
+    static QString fileName(quint16 icon);
+
+    // Russian condition text, same for day and night icons
+    static QString conditionText(quint16 icon);
+
+    static bool isNight(quint16 icon);
+    static int clouds(quint16 icon);                    // 0..4
+    static Precipitation precipitation(quint16 icon);
+    static int intensity(quint16 icon);                 // 1..4 if there is precipitation
+    static bool thunderstorm(quint16 icon);
+
+    static quint16 make(bool night, int clouds, Precipitation precipitation, int intensity, bool thunderstorm);
+
+};
+
+class WeatherData
+{
+
+public:
+    enum {
+        NoValue = -32768,   // numeric value is missing
+        MaxForecasts = 10,
+        MaxHourly = 16
+    };
+
+    enum WindDirection {
+        UnknownWind,
+        VariableWind,
+        North,
+        NorthEast,
+        East,
+        SouthEast,
+        South,
+        SouthWest,
+        West,
+        NorthWest
+    };
+
+    WeatherData();
+
+    // Compares everything but update time
+    bool hasSameValues(const WeatherData &other) const;
+
+    // When the page was parsed
+    QDateTime updated;
+
+    // Current observation information.
+    QString date;
+    QString condition;
+    quint16 conditionIcon;
+    qint16 temperature;             // °C
+    qint16 pressure;                // mm Hg
+    quint8 windDirection;
+    qint16 windSpeed;               // m/s
+    qint16 humidity;                // %
+    qint16 waterTemperature;        // °C
+
+    struct Forecast
+    {
+        Forecast();
+
+        quint8 day;                 // 1 is Monday, 0 if unknown
+        quint16 icon;
+        qint16 temperatureHigh;
+        qint16 temperatureLow;
+    };
+
+    // Counts day records on the page, at most MaxForecasts are kept
+    quint8 forecastCount;
+    Forecast forecasts[MaxForecasts];
+
+    int forecastSize() const
+    {
+        return qMin<int>(forecastCount, MaxForecasts);
+    }
+
+    // Rows of weather-daily table, parsed only for sources asking for them
+    struct Hourly
+    {
+        Hourly();
+
+        QString date;               // local time as on the page
+        QString condition;
+        qint16 temperature;         // °C
+        qint16 pressure;            // mm Hg
+        quint8 windDirection;
+        qint16 windSpeed;           // m/s
+        qint16 humidity;            // %
+        qint16 comfortTemperature;  // °C
+    };
+
+    // True if hourly rows were asked for, even if the page had none
+    bool hasHourly;
+
+    // Rows found on the page, only the first MaxHourly are kept. The
+    // vector is shared between copies and allocates nothing for daily data.
+    quint8 hourlyCount;
+    QVector<Hourly> hourly;
+
+    int hourlySize() const
+    {
+        return hourly.size();
+    }
+
+};
+
+struct XMLMapInfo {
+    QString name;
+    QString link;
+    int id;
+};
+
+// True if the string is a Gismeteo city id, that is only digits. Codes
+// come from source names and end up in URLs and cache file names.
+bool isCityCode(const QString &code);
+
+Q_DECLARE_METATYPE(WeatherData)
+Q_DECLARE_METATYPE(QList<XMLMapInfo>)
+
+#endif
@@ -0,0 +1,162 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* On-disk cache of parsed Gismeteo weather */
+
+#include "gismeteo_diskcache.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+
+#include <KDebug>
+#include <KSaveFile>
+
+static const quint32 cacheMagic = 0x474d5743; // "GMWC"
+static const quint16 cacheVersion = 3;
+
+static QDataStream &operator<<(QDataStream &stream, const WeatherData::Forecast &forecast)
+{
+    return stream << forecast.day << forecast.icon << forecast.temperatureHigh << forecast.temperatureLow;
+}
+
+static QDataStream &operator>>(QDataStream &stream, WeatherData::Forecast &forecast)
+{
+    return stream >> forecast.day >> forecast.icon >> forecast.temperatureHigh >> forecast.temperatureLow;
+}
+
+static QDataStream &operator<<(QDataStream &stream, const WeatherData::Hourly &hourly)
+{
+    return stream << hourly.date << hourly.condition << hourly.temperature << hourly.pressure
+                  << hourly.windDirection << hourly.windSpeed << hourly.humidity << hourly.comfortTemperature;
+}
+
+static QDataStream &operator>>(QDataStream &stream, WeatherData::Hourly &hourly)
+{
+    return stream >> hourly.date >> hourly.condition >> hourly.temperature >> hourly.pressure
+                  >> hourly.windDirection >> hourly.windSpeed >> hourly.humidity >> hourly.comfortTemperature;
+}
+
+static QDataStream &operator<<(QDataStream &stream, const WeatherData &data)
+{
+    stream << data.updated << data.date << data.condition << data.conditionIcon
+           << data.temperature << data.pressure << data.windDirection << data.windSpeed
+           << data.humidity << data.waterTemperature;
+
+    stream << quint8(data.forecastSize());
+    for (int i = 0; i < data.forecastSize(); ++i) {
+        stream << data.forecasts[i];
+    }
+
+    stream << data.hasHourly << quint8(data.hourlySize());
+    for (int i = 0; i < data.hourlySize(); ++i) {
+        stream << data.hourly.at(i);
+    }
+    return stream;
+}
+
+static QDataStream &operator>>(QDataStream &stream, WeatherData &data)
+{
+    stream >> data.updated >> data.date >> data.condition >> data.conditionIcon
+           >> data.temperature >> data.pressure >> data.windDirection >> data.windSpeed
+           >> data.humidity >> data.waterTemperature;
+
+    quint8 count = 0;
+    stream >> count;
+    data.forecastCount = qMin<int>(count, WeatherData::MaxForecasts);
+    for (int i = 0; i < data.forecastCount && stream.status() == QDataStream::Ok; ++i) {
+        stream >> data.forecasts[i];
+    }
+
+    stream >> data.hasHourly >> count;
+    data.hourlyCount = qMin<int>(count, WeatherData::MaxHourly);
+    data.hourly.clear();
+    for (int i = 0; i < data.hourlyCount && stream.status() == QDataStream::Ok; ++i) {
+        WeatherData::Hourly hourly;
+        stream >> hourly;
+        data.hourly.append(hourly);
+    }
+    return stream;
+}
+
+GismeteoDiskCache::GismeteoDiskCache(const QString &directory)
+    : m_directory(directory)
+{
+    QDir().mkpath(m_directory);
+}
+
+// Empty for codes that could point outside of the cache directory
+QString GismeteoDiskCache::fileName(const QString &code) const
+{
+    Q_ASSERT(isCityCode(code));
+    if (!isCityCode(code)) {
+        return QString();
+    }
+    return m_directory + '/' + code + ".dat";
+}
+
+bool GismeteoDiskCache::load(const QString &code, WeatherData &data) const
+{
+    const QString name = fileName(code);
+    QFile file(name);
+    if (name.isEmpty() || !file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_6);
+
+    quint32 magic = 0;
+    quint16 version = 0;
+    stream >> magic >> version;
+    if (magic != cacheMagic || version != cacheVersion) {
+        kDebug() << "Ignoring cache file of unknown format" << file.fileName();
+        return false;
+    }
+
+    WeatherData cached;
+    stream >> cached;
+    if (stream.status() != QDataStream::Ok) {
+        kDebug() << "Cache file is corrupted" << file.fileName();
+        return false;
+    }
+
+    data = cached;
+    return true;
+}
+
+bool GismeteoDiskCache::save(const QString &code, const WeatherData &data) const
+{
+    const QString name = fileName(code);
+    if (name.isEmpty()) {
+        return false;
+    }
+
+    KSaveFile file(name);
+    if (!file.open()) {
+        kDebug() << "Can't write cache file" << file.fileName() << file.errorString();
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream << cacheMagic << cacheVersion << data;
+
+    return file.finalize();
+}
@@ -0,0 +1,48 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* On-disk cache of parsed Gismeteo weather */
+
+#ifndef GISMETEO_DISKCACHE_H
+#define GISMETEO_DISKCACHE_H
+
+#include <QString>
+
+#include "gismeteo_data.h"
+
+// Keeps last parsed weather of every city in a small binary file, so it
+// can be shown right after startup while the page is being downloaded.
+class GismeteoDiskCache
+{
+
+public:
+    // Cache files are kept in the directory
+    explicit GismeteoDiskCache(const QString &directory);
+
+    bool load(const QString &code, WeatherData &data) const;
+    bool save(const QString &code, const WeatherData &data) const;
+
+private:
+    QString fileName(const QString &code) const;
+
+    QString m_directory;
+
+};
+
+#endif
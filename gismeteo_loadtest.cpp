@@ -0,0 +1,200 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* Load test of Gismeteo ion through the weather engine */
+
+// Connects thousands of weather and validate sources to the weather
+// engine at once and measures how long it takes until each of them gets
+// fresh data. Run it against gismeteo-mockserver, for example:
+//
+//   GISMETEO_BASE_URL=http://localhost:8080/ gismeteo-loadtest --weather 2000 --validate 500
+//
+// Result is printed as a JSON object to stdout. Weather the ion saves
+// goes to a temporary directory, removed when the test is over.
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QTimer>
+#include <QVector>
+#include <QtAlgorithms>
+
+#include <KAboutData>
+#include <KApplication>
+#include <KCmdLineArgs>
+#include <KLocale>
+#include <KTempDir>
+
+#include <Plasma/DataEngine>
+#include <Plasma/DataEngineManager>
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+class LoadTest : public QObject
+{
+    Q_OBJECT
+
+public:
+    LoadTest(Plasma::DataEngine *engine, int weatherSources, int validateSources, int timeout)
+        : m_engine(engine), m_weatherSources(weatherSources), m_validateSources(validateSources), m_failures(0)
+    {
+        m_timeout.setSingleShot(true);
+        m_timeout.setInterval(timeout * 1000);
+        connect(&m_timeout, SIGNAL(timeout()), this, SLOT(finish()));
+    }
+
+public slots:
+    void start()
+    {
+        m_startRss = currentRss();
+        m_timer.start();
+        m_timeout.start();
+
+        // Distinct codes and places, so that every source needs a download
+        for (int i = 0; i < m_weatherSources; ++i) {
+            connectSource(QString("gismeteo|weather|place%1|%2").arg(i).arg(100000 + i));
+        }
+        for (int i = 0; i < m_validateSources; ++i) {
+            connectSource(QString("gismeteo|validate|place%1").arg(i));
+        }
+    }
+
+    void dataUpdated(const QString &source, const Plasma::DataEngine::Data &data)
+    {
+        if (!m_pending.contains(source)) {
+            return;
+        }
+
+        // Wait for fresh weather, cached one is shown while downloading
+        if (source.contains("|weather|") && (data.isEmpty() || data.value("Cached").toBool())) {
+            return;
+        }
+        if (source.contains("|validate|") && !data.contains("validate")) {
+            return;
+        }
+
+        const QString reply = data.value("validate").toString();
+        if (reply.contains("|timeout") || reply.contains("|malformed")) {
+            ++m_failures;
+        }
+
+        m_latencies.append(m_timer.elapsed() - m_pending.take(source));
+        if (m_pending.isEmpty()) {
+            finish();
+        }
+    }
+
+    void finish()
+    {
+        m_timeout.stop();
+
+        QVector<qint64> latencies = m_latencies;
+        qSort(latencies);
+        const int last = latencies.size() - 1;
+
+        printf("{\"sources\": %d, \"completed\": %d, \"failures\": %d, \"seconds\": %.3f, "
+               "\"latency_p50_ms\": %lld, \"latency_p95_ms\": %lld, \"latency_p99_ms\": %lld, "
+               "\"latency_max_ms\": %lld, \"rss_start_kb\": %ld, \"rss_end_kb\": %ld, \"peak_rss_kb\": %ld}\n",
+               m_weatherSources + m_validateSources, latencies.size(), m_failures, m_timer.elapsed() / 1000.0,
+               last < 0 ? 0 : latencies.at(last * 50 / 100),
+               last < 0 ? 0 : latencies.at(last * 95 / 100),
+               last < 0 ? 0 : latencies.at(last * 99 / 100),
+               last < 0 ? 0 : latencies.at(last),
+               m_startRss, currentRss(), peakRss());
+        fflush(stdout);
+
+        qApp->quit();
+    }
+
+private:
+    void connectSource(const QString &source)
+    {
+        m_pending.insert(source, m_timer.elapsed());
+        m_engine->connectSource(source, this);
+    }
+
+    static long currentRss()
+    {
+        QFile statm("/proc/self/statm");
+        if (!statm.open(QIODevice::ReadOnly)) {
+            return 0;
+        }
+        const QList<QByteArray> fields = statm.readAll().split(' ');
+        return fields.size() > 1 ? fields.at(1).toLong() * (sysconf(_SC_PAGESIZE) / 1024) : 0;
+    }
+
+    static long peakRss()
+    {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+    }
+
+    Plasma::DataEngine *m_engine;
+    int m_weatherSources;
+    int m_validateSources;
+    int m_failures;
+    long m_startRss;
+
+    QElapsedTimer m_timer;
+    QTimer m_timeout;
+
+    // Sources without fresh data yet, with time they were connected
+    QHash<QString, qint64> m_pending;
+    QVector<qint64> m_latencies;
+};
+
+int main(int argc, char **argv)
+{
+    KAboutData aboutData("gismeteo-loadtest", 0, ki18n("Gismeteo ion load test"), "0.1");
+    KCmdLineArgs::init(argc, argv, &aboutData);
+
+    KCmdLineOptions options;
+    options.add("weather <count>", ki18n("Number of weather sources"), "1000");
+    options.add("validate <count>", ki18n("Number of validate sources"), "0");
+    options.add("timeout <seconds>", ki18n("Give up waiting after this time"), "300");
+    KCmdLineArgs::addCmdLineOptions(options);
+
+    KApplication app(false);
+    KCmdLineArgs *args = KCmdLineArgs::parsedArgs();
+
+    // Ion runs in this process and picks the directory up when loaded
+    KTempDir cacheDir;
+    if (cacheDir.status() != 0) {
+        fprintf(stderr, "Can't create temporary cache directory\n");
+        return 1;
+    }
+    qputenv("GISMETEO_CACHE_DIR", QFile::encodeName(cacheDir.name()));
+
+    Plasma::DataEngine *engine = Plasma::DataEngineManager::self()->loadEngine("weather");
+    if (!engine->isValid()) {
+        fprintf(stderr, "Can't load weather engine\n");
+        return 1;
+    }
+
+    LoadTest loadTest(engine, args->getOption("weather").toInt(), args->getOption("validate").toInt(),
+                      args->getOption("timeout").toInt());
+    QTimer::singleShot(0, &loadTest, SLOT(start()));
+
+    return app.exec();
+}
+
+#include "gismeteo_loadtest.moc"
@@ -0,0 +1,302 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* Local stand-in of Gismeteo site for load testing */
+
+// Usage: gismeteo-mockserver [options] <corpus>
+//
+//   -p port          port to listen on, 8080 by default
+//   -l milliseconds  delay before response starts
+//   -b bytes         bandwidth per connection in bytes per second, 0 is unlimited
+//   -c bytes         size of chunks the body is written in, 4096 by default
+//   -e rate          share of requests answered with 503, 0..1
+//   -v 0|1           send ETag and Last-Modified, answer conditional
+//                    requests for an unchanged page with 304, off by default
+//
+// Daily pages are served from <corpus>/daily/<code>.html, or from any
+// page in that directory in turn if there is no page for the code.
+// Search requests get <corpus>/search/*.html in turn. Point the ion to
+// the server with GISMETEO_BASE_URL=http://localhost:8080/
+
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QLocale>
+#include <QStringList>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+struct MockOptions
+{
+    MockOptions() : port(8080), latency(0), bandwidth(0), chunkSize(4096), errorRate(0), validators(false) {}
+
+    quint16 port;
+    int latency;
+    int bandwidth;
+    int chunkSize;
+    double errorRate;
+    bool validators;
+};
+
+// Value of a request header, empty if there is none
+static QByteArray requestHeader(const QByteArray &request, const QByteArray &name)
+{
+    foreach (const QByteArray &line, request.split('\n')) {
+        const int colon = line.indexOf(':');
+        if (colon > 0 && line.left(colon).trimmed().toLower() == name.toLower()) {
+            return line.mid(colon + 1).trimmed();
+        }
+    }
+    return QByteArray();
+}
+
+class MockPages
+{
+
+public:
+    explicit MockPages(const QDir &corpus)
+        : m_nextDaily(0), m_nextSearch(0)
+    {
+        load(corpus.filePath("daily"), m_daily, m_dailyList);
+        load(corpus.filePath("search"), m_search, m_searchList);
+    }
+
+    bool isEmpty() const
+    {
+        return m_dailyList.isEmpty() && m_searchList.isEmpty();
+    }
+
+    QByteArray daily(const QString &code)
+    {
+        QHash<QString, QByteArray>::const_iterator it = m_daily.constFind(code);
+        if (it != m_daily.constEnd()) {
+            return it.value();
+        }
+        return next(m_dailyList, m_nextDaily);
+    }
+
+    QByteArray search()
+    {
+        return next(m_searchList, m_nextSearch);
+    }
+
+private:
+    static void load(const QString &path, QHash<QString, QByteArray> &pages, QList<QByteArray> &list)
+    {
+        const QDir dir(path);
+        foreach (const QString &name, dir.entryList(QStringList() << "*.html", QDir::Files, QDir::Name)) {
+            QFile file(dir.filePath(name));
+            if (file.open(QIODevice::ReadOnly)) {
+                const QByteArray page = file.readAll();
+                pages.insert(QFileInfo(name).completeBaseName(), page);
+                list.append(page);
+            }
+        }
+    }
+
+    static QByteArray next(const QList<QByteArray> &list, int &index)
+    {
+        if (list.isEmpty()) {
+            return QByteArray();
+        }
+        index = (index + 1) % list.size();
+        return list.at(index);
+    }
+
+    QHash<QString, QByteArray> m_daily;
+    QHash<QString, QByteArray> m_search;
+    QList<QByteArray> m_dailyList;
+    QList<QByteArray> m_searchList;
+    int m_nextDaily;
+    int m_nextSearch;
+
+};
+
+// One HTTP/1.0 exchange, response is written in paced chunks
+class MockConnection : public QObject
+{
+    Q_OBJECT
+
+public:
+    MockConnection(QTcpSocket *socket, MockPages *pages, const MockOptions &options)
+        : QObject(socket), m_socket(socket), m_pages(pages), m_options(options), m_offset(0)
+    {
+        connect(socket, SIGNAL(readyRead()), this, SLOT(readRequest()));
+        connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+        connect(&m_timer, SIGNAL(timeout()), this, SLOT(writeChunk()));
+    }
+
+private slots:
+    void readRequest()
+    {
+        m_request.append(m_socket->readAll());
+        if (!m_request.contains("\r\n\r\n") || !m_response.isEmpty()) {
+            return;
+        }
+
+        // GET /city/daily/4368/ HTTP/1.1
+        const QList<QByteArray> requestLine = m_request.left(m_request.indexOf("\r\n")).split(' ');
+        const QString path = requestLine.size() > 1 ? QString::fromLatin1(requestLine.at(1)) : QString();
+
+        QByteArray body;
+        if (path.startsWith("/city/daily/")) {
+            body = m_pages->daily(path.section('/', 3, 3));
+        } else if (path.startsWith("/city/")) {
+            body = m_pages->search();
+        }
+
+        QByteArray status = "200 OK";
+        QByteArray validators;
+        if (body.isEmpty()) {
+            status = "404 Not Found";
+        } else if (m_options.errorRate > 0 && qrand() < m_options.errorRate * RAND_MAX) {
+            status = "503 Service Unavailable";
+            body.clear();
+        } else if (m_options.validators) {
+            // Pages never change while the server runs
+            static const QByteArray lastModified = QLocale::c().toString(
+                QDateTime::currentDateTime().toUTC(), "ddd, dd MMM yyyy hh:mm:ss 'GMT'").toLatin1();
+            const QByteArray etag = '"' + QCryptographicHash::hash(body, QCryptographicHash::Md5).toHex() + '"';
+            validators = "ETag: " + etag + "\r\n"
+                         "Last-Modified: " + lastModified + "\r\n";
+
+            const QByteArray ifNoneMatch = requestHeader(m_request, "If-None-Match");
+            const QByteArray ifModifiedSince = requestHeader(m_request, "If-Modified-Since");
+            if (ifNoneMatch.isEmpty() ? ifModifiedSince == lastModified : ifNoneMatch == etag) {
+                status = "304 Not Modified";
+                body.clear();
+            }
+        }
+
+        m_response = "HTTP/1.0 " + status + "\r\n"
+                     "Content-Type: text/html; charset=utf-8\r\n"
+                     + validators +
+                     "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+                     "Connection: close\r\n"
+                     "\r\n" + body;
+
+        // With bandwidth limit a chunk goes out every interval
+        const int interval = m_options.bandwidth > 0 ? m_options.chunkSize * 1000 / m_options.bandwidth : 0;
+        m_timer.setInterval(interval);
+        QTimer::singleShot(m_options.latency, &m_timer, SLOT(start()));
+    }
+
+    void writeChunk()
+    {
+        const int size = qMin(m_options.chunkSize, m_response.size() - m_offset);
+        m_socket->write(m_response.constData() + m_offset, size);
+        m_offset += size;
+
+        if (m_offset >= m_response.size()) {
+            m_timer.stop();
+            m_socket->disconnectFromHost();
+        }
+    }
+
+private:
+    QTcpSocket *m_socket;
+    MockPages *m_pages;
+    MockOptions m_options;
+    QTimer m_timer;
+    QByteArray m_request;
+    QByteArray m_response;
+    int m_offset;
+};
+
+class MockServer : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    MockServer(MockPages *pages, const MockOptions &options)
+        : m_pages(pages), m_options(options)
+    {
+        connect(this, SIGNAL(newConnection()), this, SLOT(acceptConnections()));
+    }
+
+private slots:
+    void acceptConnections()
+    {
+        while (hasPendingConnections()) {
+            new MockConnection(nextPendingConnection(), m_pages, m_options);
+        }
+    }
+
+private:
+    MockPages *m_pages;
+    MockOptions m_options;
+};
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QStringList args = app.arguments();
+    args.removeFirst();
+
+    MockOptions options;
+    while (args.size() >= 2 && args.first().startsWith('-')) {
+        const QString option = args.takeFirst();
+        const QString value = args.takeFirst();
+        if (option == "-p") {
+            options.port = value.toUShort();
+        } else if (option == "-l") {
+            options.latency = qMax(0, value.toInt());
+        } else if (option == "-b") {
+            options.bandwidth = qMax(0, value.toInt());
+        } else if (option == "-c") {
+            options.chunkSize = qMax(1, value.toInt());
+        } else if (option == "-e") {
+            options.errorRate = qBound(0.0, value.toDouble(), 1.0);
+        } else if (option == "-v") {
+            options.validators = value.toInt() != 0;
+        } else {
+            args.clear();
+        }
+    }
+
+    if (args.size() != 1) {
+        fprintf(stderr, "Usage: gismeteo-mockserver [-p port] [-l latency] [-b bandwidth] [-c chunk] [-e errors] [-v validators] <corpus>\n");
+        return 1;
+    }
+
+    MockPages pages((QDir(args.first())));
+    if (pages.isEmpty()) {
+        fprintf(stderr, "No pages found in %s\n", qPrintable(args.first()));
+        return 1;
+    }
+
+    MockServer server(&pages, options);
+    if (!server.listen(QHostAddress::LocalHost, options.port)) {
+        fprintf(stderr, "Can't listen on port %d: %s\n", options.port, qPrintable(server.errorString()));
+        return 1;
+    }
+
+    return app.exec();
+}
+
+#include "gismeteo_mockserver.moc"
@@ -0,0 +1,144 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* Worker pool parsing Gismeteo pages off the main thread */
+
+#include "gismeteo_parsepool.h"
+
+#include <QRunnable>
+#include <QThread>
+
+#include <KDebug>
+
+#include "gismeteo_parser.h"
+#include "gismeteo_querycache.h"
+
+class GismeteoParsePool::Runnable : public QRunnable
+{
+public:
+    Runnable(GismeteoParsePool *pool, const Task &task)
+        : m_pool(pool), m_task(task)
+    {
+    }
+
+    void run()
+    {
+        const GismeteoCompiledQuery query = m_pool->m_queryCache->query(m_task.queryFiles);
+
+        if (m_task.kind == Weather) {
+            WeatherData data;
+            bool ok = GismeteoParser::readHTMLData(query.query, query.elementIds, m_task.html, data);
+            QMetaObject::invokeMethod(m_pool, "slotWeatherParsed", Qt::QueuedConnection,
+                                      Q_ARG(QString, m_task.source),
+                                      Q_ARG(WeatherData, data),
+                                      Q_ARG(bool, ok));
+        } else {
+            QList<XMLMapInfo> places;
+            bool ok = GismeteoParser::readSearchHTMLData(query.query, query.elementIds, m_task.html, places);
+            QMetaObject::invokeMethod(m_pool, "slotSearchParsed", Qt::QueuedConnection,
+                                      Q_ARG(QString, m_task.source),
+                                      Q_ARG(QList<XMLMapInfo>, places),
+                                      Q_ARG(bool, ok));
+        }
+    }
+
+private:
+    GismeteoParsePool *m_pool;
+    Task m_task;
+};
+
+GismeteoParsePool::GismeteoParsePool(GismeteoQueryCache *queryCache, QObject *parent)
+    : QObject(parent),
+      m_queryCache(queryCache),
+      m_inFlight(0)
+{
+    qRegisterMetaType<WeatherData>("WeatherData");
+    qRegisterMetaType<QList<XMLMapInfo> >("QList<XMLMapInfo>");
+
+    m_pool.setMaxThreadCount(qMax(1, QThread::idealThreadCount()));
+    m_maxInFlight = m_pool.maxThreadCount() * 2;
+}
+
+GismeteoParsePool::~GismeteoParsePool()
+{
+    m_pending.clear();
+    m_pool.waitForDone();
+}
+
+void GismeteoParsePool::setMaxInFlight(int max)
+{
+    m_maxInFlight = qMax(1, max);
+    startPending();
+}
+
+int GismeteoParsePool::maxInFlight() const
+{
+    return m_maxInFlight;
+}
+
+void GismeteoParsePool::parse(Kind kind, const QString &source, const QStringList &queryFiles, const QByteArray &html)
+{
+    Task task;
+    task.kind = kind;
+    task.source = source;
+    task.queryFiles = queryFiles;
+    task.html = html;
+
+    // Newer page for the same source supersedes the one still waiting
+    for (int i = 0; i < m_pending.size(); ++i) {
+        if (m_pending.at(i).kind == kind && m_pending.at(i).source == source) {
+            m_pending[i] = task;
+            return;
+        }
+    }
+
+    m_pending.enqueue(task);
+    startPending();
+}
+
+void GismeteoParsePool::start(const Task &task)
+{
+    ++m_inFlight;
+    m_pool.start(new Runnable(this, task));
+}
+
+void GismeteoParsePool::startPending()
+{
+    while (m_inFlight < m_maxInFlight && !m_pending.isEmpty()) {
+        start(m_pending.dequeue());
+    }
+}
+
+void GismeteoParsePool::slotWeatherParsed(const QString &source, const WeatherData &data, bool ok)
+{
+    --m_inFlight;
+    startPending();
+
+    emit weatherParsed(source, data, ok);
+}
+
+void GismeteoParsePool::slotSearchParsed(const QString &source, const QList<XMLMapInfo> &places, bool ok)
+{
+    --m_inFlight;
+    startPending();
+
+    emit searchParsed(source, places, ok);
+}
+
+#include "gismeteo_parsepool.moc"
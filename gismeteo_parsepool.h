@@ -0,0 +1,85 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* Worker pool parsing Gismeteo pages off the main thread */
+
+#ifndef GISMETEO_PARSEPOOL_H
+#define GISMETEO_PARSEPOOL_H
+
+#include <QObject>
+#include <QQueue>
+#include <QStringList>
+#include <QThreadPool>
+
+#include "gismeteo_data.h"
+
+class GismeteoQueryCache;
+
+// Runs page parsing in a bounded pool of worker threads. Parsed results
+// are delivered back to the thread owning the pool by queued signals.
+class GismeteoParsePool : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Kind {
+        Weather,
+        Search
+    };
+
+    explicit GismeteoParsePool(GismeteoQueryCache *queryCache, QObject *parent = 0);
+    ~GismeteoParsePool();
+
+    // Queue a page for parsing with the query made of the files
+    void parse(Kind kind, const QString &source, const QStringList &queryFiles, const QByteArray &html);
+
+    // Maximum number of documents being parsed or waiting in the thread pool
+    void setMaxInFlight(int max);
+    int maxInFlight() const;
+
+Q_SIGNALS:
+    void weatherParsed(const QString &source, const WeatherData &data, bool ok);
+    void searchParsed(const QString &source, const QList<XMLMapInfo> &places, bool ok);
+
+private Q_SLOTS:
+    void slotWeatherParsed(const QString &source, const WeatherData &data, bool ok);
+    void slotSearchParsed(const QString &source, const QList<XMLMapInfo> &places, bool ok);
+
+private:
+    struct Task {
+        Kind kind;
+        QString source;
+        QStringList queryFiles;
+        QByteArray html;
+    };
+
+    class Runnable;
+
+    void start(const Task &task);
+    void startPending();
+
+    GismeteoQueryCache *m_queryCache;
+    QThreadPool m_pool;
+    QQueue<Task> m_pending;
+    int m_inFlight;
+    int m_maxInFlight;
+
+};
+
+#endif
@@ -0,0 +1,594 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* Gismeteo HTML parsers */
+
+#include "gismeteo_parser.h"
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QRegExp>
+#include <QStringList>
+#include <QAbstractXmlReceiver>
+
+#include "gismeteo_sectionfilter.h"
+#include "gismeteo_stats.h"
+#include "gismeteo_trace.h"
+
+#include <qlibxmlnodemodel.h>
+
+// Elements produced by the queries. Their names are interned into the
+// name pool of a query once, then every element is looked up by its
+// QXmlName in the table built along with the compiled query.
+enum Element {
+    OtherElement,
+
+    // gismeteo.xq and gismeteo-hourly.xq
+    DateElement,
+    ConditionElement,
+    ConditionIconElement,
+    TemperatureElement,
+    PressureElement,
+    WindDirectionElement,
+    WindSpeedElement,
+    HumidityElement,
+    WaterTemperatureElement,
+    ForecastElement,
+    DayElement,
+    IconElement,
+    HourlyElement,
+    HourElement,
+    ComfortTemperatureElement,
+
+    // gismeteo-search.xq
+    PlaceElement,
+    NameElement,
+    LinkElement,
+
+    ElementCount
+};
+
+static const char * const elementNames[ElementCount] = {
+    0,
+    "date",
+    "condition",
+    "conditionIcon",
+    "temperature",
+    "pressure",
+    "windDirection",
+    "windSpeed",
+    "humidity",
+    "waterTemperature",
+    "forecast",
+    "day",
+    "icon",
+    "hourly",
+    "hour",
+    "comfortTemperature",
+    "place",
+    "name",
+    "link"
+};
+
+// Open elements are kept in a fixed array, so walking the result doesn't
+// allocate
+class ElementStack
+{
+public:
+    enum { MaxDepth = 32 };
+
+    ElementStack() : m_depth(0) {}
+
+    void push(quint8 element)
+    {
+        // Deeper elements are only counted, nothing we read is that deep
+        if (m_depth < MaxDepth) {
+            m_elements[m_depth] = element;
+        }
+        ++m_depth;
+    }
+
+    void pop()
+    {
+        if (m_depth > 0) {
+            --m_depth;
+        }
+    }
+
+    quint8 top() const
+    {
+        return m_depth > 0 && m_depth <= MaxDepth ? m_elements[m_depth - 1] : 0;
+    }
+
+private:
+    quint8 m_elements[MaxDepth];
+    int m_depth;
+};
+
+// Receiver for html weather data
+class Receiver : public QAbstractXmlReceiver
+{
+public:
+    Receiver(const GismeteoParser::ElementIds &ids, WeatherData &weatherData);
+    void atomicValue(const QVariant &);
+    void endElement();
+    void startElement(const QXmlName &name);
+
+    void attribute(const QXmlName &, const QStringRef &) {};
+    void characters(const QStringRef &) {}
+    void comment(const QString &) {}
+    void endDocument() {}
+    void endOfSequence() {}
+    void namespaceBinding(const QXmlName &) {}
+    void processingInstruction(const QXmlName &, const QString &) {}
+    void startDocument() {}
+    void startOfSequence() {}
+
+    WeatherData &m_weatherData;
+
+private:
+    // Field to fill, for current conditions, forecast days and hourly rows
+    enum Context {
+        CurrentContext,
+        ForecastContext,
+        HourlyContext
+    };
+    static const GismeteoParser::Field elementFields[3][ElementCount];
+
+    Context m_context;
+
+    const GismeteoParser::ElementIds &m_ids;
+    ElementStack m_elements;
+};
+
+const GismeteoParser::Field Receiver::elementFields[3][ElementCount] = {
+    {
+        GismeteoParser::NoField,
+        GismeteoParser::Date,
+        GismeteoParser::Condition,
+        GismeteoParser::ConditionIcon,
+        GismeteoParser::Temperature,
+        GismeteoParser::Pressure,
+        GismeteoParser::WindDirection,
+        GismeteoParser::WindSpeed,
+        GismeteoParser::Humidity,
+        GismeteoParser::WaterTemperature,
+        GismeteoParser::NoField,
+        GismeteoParser::NoField,
+        GismeteoParser::NoField,
+        GismeteoParser::NoField,
+        GismeteoParser::NoField,
+        GismeteoParser::NoField,
+        GismeteoParser::NoField,
+        GismeteoParser::NoField,
+        GismeteoParser::NoField
+    },
+    {
+        GismeteoParser::NoField,
+        GismeteoParser::NoField,
+        GismeteoParser::NoField,
+        GismeteoParser::NoField,
+        GismeteoParser::ForecastTemperature,
+        GismeteoParser::NoField,
+        GismeteoParser::NoField,
+        GismeteoParser::NoField,
+        GismeteoParser::NoField,
+        GismeteoParser::NoField,
+        GismeteoParser::NoField,
+        GismeteoParser::ForecastDay,
+        GismeteoParser::ForecastIcon,
+        GismeteoParser::NoField,
+        GismeteoParser::NoField,
+        GismeteoParser::NoField,
+        GismeteoParser::NoField,
+        GismeteoParser::NoField,
+        GismeteoParser::NoField
+    },
+    {
+        GismeteoParser::NoField,
+        GismeteoParser::HourlyDate,
+        GismeteoParser::HourlyCondition,
+        GismeteoParser::NoField,
+        GismeteoParser::HourlyTemperature,
+        GismeteoParser::HourlyPressure,
+        GismeteoParser::HourlyWindDirection,
+        GismeteoParser::HourlyWindSpeed,
+        GismeteoParser::HourlyHumidity,
+        GismeteoParser::NoField,
+        GismeteoParser::NoField,
+        GismeteoParser::NoField,
+        GismeteoParser::NoField,
+        GismeteoParser::NoField,
+        GismeteoParser::NoField,
+        GismeteoParser::HourlyComfortTemperature,
+        GismeteoParser::NoField,
+        GismeteoParser::NoField,
+        GismeteoParser::NoField
+    }
+};
+
+Receiver::Receiver(const GismeteoParser::ElementIds &ids, WeatherData &weatherData)
+    : m_weatherData(weatherData),
+      m_context(CurrentContext),
+      m_ids(ids)
+{
+}
+
+// Called for every element
+void Receiver::startElement(const QXmlName &xmlname)
+{
+    const quint8 element = m_ids.value(xmlname, 0);
+    m_elements.push(element);
+
+    if (element == ForecastElement) {
+        m_context = ForecastContext;
+        GismeteoParser::setField(m_weatherData, GismeteoParser::ForecastRecord, QString());
+    } else if (element == HourlyElement) {
+        m_weatherData.hasHourly = true;
+    } else if (element == HourElement) {
+        m_context = HourlyContext;
+        GismeteoParser::setField(m_weatherData, GismeteoParser::HourlyRecord, QString());
+    }
+}
+
+void Receiver::endElement()
+{
+    m_elements.pop();
+}
+
+// Called for every text node
+void Receiver::atomicValue(const QVariant &val)
+{
+    const GismeteoParser::Field field = elementFields[m_context][m_elements.top()];
+    if (field == GismeteoParser::NoField) {
+        return;
+    }
+
+    const QString value = val.toString();
+    gismeteoTrace(Parser) << field << value;
+
+    GismeteoParser::setField(m_weatherData, field, value);
+}
+
+// Receiver for html search data
+class SearchReceiver : public QAbstractXmlReceiver
+{
+public:
+    SearchReceiver(const GismeteoParser::ElementIds &ids, QList<XMLMapInfo> &places);
+    void atomicValue(const QVariant &);
+    void endElement();
+    void startElement(const QXmlName &name);
+
+    void attribute(const QXmlName &, const QStringRef &) {};
+    void characters(const QStringRef &) {}
+    void comment(const QString &) {}
+    void endDocument() {}
+    void endOfSequence() {}
+    void namespaceBinding(const QXmlName &) {}
+    void processingInstruction(const QXmlName &, const QString &) {}
+    void startDocument() {}
+    void startOfSequence() {}
+
+    QList<XMLMapInfo> &m_places;
+
+private:
+    const GismeteoParser::ElementIds &m_ids;
+    ElementStack m_elements;
+
+    XMLMapInfo m_currentPlace;
+};
+
+SearchReceiver::SearchReceiver(const GismeteoParser::ElementIds &ids, QList<XMLMapInfo> &places)
+    : m_places(places),
+      m_ids(ids)
+{
+}
+
+// Called for every element
+void SearchReceiver::startElement(const QXmlName &xmlname)
+{
+    const quint8 element = m_ids.value(xmlname, 0);
+    m_elements.push(element);
+
+    if (element == PlaceElement) {
+        m_currentPlace = XMLMapInfo();
+        m_currentPlace.id = 0;
+    }
+}
+
+void SearchReceiver::endElement()
+{
+    if (m_elements.top() == PlaceElement) {
+        m_places.append(m_currentPlace);
+    }
+
+    m_elements.pop();
+}
+
+// Called for every text node
+void SearchReceiver::atomicValue(const QVariant &val)
+{
+    const quint8 element = m_elements.top();
+    if (element != NameElement && element != LinkElement) {
+        return;
+    }
+
+    const QString value = val.toString();
+    gismeteoTrace(Parser) << element << value;
+
+    if (element == NameElement) {
+        m_currentPlace.name = value;
+    } else {
+        m_currentPlace.link = value;
+
+        QRegExp rxlink("/city/daily/([0-9]+)/");
+        int pos = rxlink.indexIn(value);
+        if (pos > -1) {
+            m_currentPlace.id = rxlink.cap(1).toInt();
+        }
+    }
+}
+
+
+// Number with unit suffix stripped, like +12 or −3 (minus sign)
+static qint16 parseNumber(QString value, const char *unit)
+{
+    const QString suffix = QString::fromUtf8(unit);
+    value = value.trimmed();
+    if (value.endsWith(suffix)) {
+        value.chop(suffix.size());
+    }
+
+    value.replace(QChar(0x2212), '-');
+    value.replace(',', '.');
+
+    bool ok = false;
+    const double number = value.trimmed().toDouble(&ok);
+    if (!ok || number < -32767 || number > 32767) {
+        return WeatherData::NoValue;
+    }
+    return qRound(number);
+}
+
+static quint8 parseDay(const QString &value)
+{
+    static const char *const days[] = { "пн", "вт", "ср", "чт", "пт", "сб", "вс" };
+
+    const QString day = value.trimmed().toLower();
+    for (int i = 0; i < 7; ++i) {
+        if (day == QString::fromUtf8(days[i])) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static quint8 parseWindDirection(const QString &value)
+{
+    static const struct {
+        const char *name;
+        WeatherData::WindDirection direction;
+    } directions[] = {
+        { "с",  WeatherData::North },
+        { "св", WeatherData::NorthEast },
+        { "в",  WeatherData::East },
+        { "юв", WeatherData::SouthEast },
+        { "ю",  WeatherData::South },
+        { "юз", WeatherData::SouthWest },
+        { "з",  WeatherData::West },
+        { "сз", WeatherData::NorthWest }
+    };
+
+    const QString direction = value.trimmed().toLower();
+    if (direction.isEmpty()) {
+        return WeatherData::VariableWind;
+    }
+    for (uint i = 0; i < sizeof(directions) / sizeof(directions[0]); ++i) {
+        if (direction == QString::fromUtf8(directions[i].name)) {
+            return directions[i].direction;
+        }
+    }
+    return WeatherData::UnknownWind;
+}
+
+void GismeteoParser::setField(WeatherData& data, Field field, QString value)
+{
+    switch (field) {
+    case Date:
+        data.date = value;
+        break;
+    case Condition:
+        data.condition = value;
+        break;
+    case ConditionIcon:
+        data.conditionIcon = WeatherIcon::encode(value);
+        break;
+    case Temperature:
+        data.temperature = parseNumber(value, "°C");
+        break;
+    case Pressure:
+        data.pressure = parseNumber(value, "мм рт.ст.");
+        break;
+    case WindDirection:
+        data.windDirection = parseWindDirection(value);
+        break;
+    case WindSpeed:
+        data.windSpeed = parseNumber(value, "м/с");
+        break;
+    case Humidity:
+        data.humidity = parseNumber(value, "%");
+        break;
+    case WaterTemperature:
+        data.waterTemperature = parseNumber(value, "°C");
+        break;
+    case ForecastRecord:
+        if (data.forecastCount < WeatherData::MaxForecasts) {
+            data.forecasts[data.forecastCount] = WeatherData::Forecast();
+        }
+        if (data.forecastCount < 255) {
+            ++data.forecastCount;
+        }
+        break;
+    case ForecastDay:
+    case ForecastIcon:
+    case ForecastTemperature:
+        // Days that didn't fit are dropped
+        if (data.forecastCount > 0 && data.forecastCount <= WeatherData::MaxForecasts) {
+            setForecastField(data.forecasts[data.forecastCount - 1], field, value);
+        }
+        break;
+    case HourlyRecord:
+        if (data.hourlyCount < WeatherData::MaxHourly) {
+            if (data.hourly.isEmpty()) {
+                data.hourly.reserve(WeatherData::MaxHourly);
+            }
+            data.hourly.append(WeatherData::Hourly());
+        }
+        if (data.hourlyCount < 255) {
+            ++data.hourlyCount;
+        }
+        break;
+    case HourlyDate:
+    case HourlyCondition:
+    case HourlyTemperature:
+    case HourlyPressure:
+    case HourlyWindDirection:
+    case HourlyWindSpeed:
+    case HourlyHumidity:
+    case HourlyComfortTemperature:
+        if (data.hourlyCount > 0 && data.hourlyCount <= WeatherData::MaxHourly) {
+            setHourlyField(data.hourly[data.hourlyCount - 1], field, value);
+        }
+        break;
+    case NoField:
+        break;
+    }
+}
+
+void GismeteoParser::setForecastField(WeatherData::Forecast& forecast, Field field, const QString& value)
+{
+    if (field == ForecastDay) {
+        forecast.day = parseDay(value);
+    } else if (field == ForecastIcon) {
+        forecast.icon = WeatherIcon::encode(value);
+    } else if (field == ForecastTemperature) {
+        const QStringList temp = value.split("..");
+        if (temp.size() == 2) {
+            forecast.temperatureLow = parseNumber(temp.at(0), "°");
+            forecast.temperatureHigh = parseNumber(temp.at(1), "°");
+        }
+    }
+}
+
+void GismeteoParser::setHourlyField(WeatherData::Hourly& hourly, Field field, const QString& value)
+{
+    switch (field) {
+    case HourlyDate: {
+        // Row title is like "Local: 2012-05-17 14:00"
+        const int pos = value.indexOf("Local: ");
+        hourly.date = (pos < 0 ? value : value.mid(pos + 7)).trimmed();
+        break;
+    }
+    case HourlyCondition:
+        hourly.condition = value.trimmed();
+        break;
+    case HourlyTemperature:
+        hourly.temperature = parseNumber(value, "°C");
+        break;
+    case HourlyPressure:
+        hourly.pressure = parseNumber(value, "мм рт.ст.");
+        break;
+    case HourlyWindDirection:
+        hourly.windDirection = parseWindDirection(value);
+        break;
+    case HourlyWindSpeed:
+        hourly.windSpeed = parseNumber(value, "м/с");
+        break;
+    case HourlyHumidity:
+        hourly.humidity = parseNumber(value, "%");
+        break;
+    case HourlyComfortTemperature:
+        hourly.comfortTemperature = parseNumber(value, "°C");
+        break;
+    default:
+        break;
+    }
+}
+
+GismeteoParser::ElementIds GismeteoParser::elementIds(const QXmlNamePool& namePool)
+{
+    // Copies of a name pool share the same names
+    QXmlNamePool pool(namePool);
+
+    ElementIds ids;
+    ids.reserve(ElementCount);
+    for (int i = 1; i < ElementCount; ++i) {
+        ids.insert(QXmlName(pool, QLatin1String(elementNames[i])), i);
+    }
+    return ids;
+}
+
+bool GismeteoParser::readHTMLData(QXmlQuery query, const ElementIds& ids, const QByteArray& xml, WeatherData& data)
+{
+    gismeteoTrace(Parser) << "readHTMLData()";
+
+    if (!query.isValid()) {
+        return false;
+    }
+
+    // Setup model over the sections the query reads
+    QElapsedTimer timer;
+    timer.start();
+    const QByteArray sections = GismeteoSectionFilter::filter(xml);
+    QLibXmlNodeModel model(query.namePool(), sections, QUrl());
+    query.setFocus(model.dom());
+    GismeteoStats::self()->record(GismeteoStats::DomBuild, timer.nsecsElapsed());
+
+    // Setup a formatter
+    Receiver receiver(ids, data);
+
+    // Evaluate query
+    GismeteoStageTimer evaluateTimer(GismeteoStats::Evaluate);
+    return query.evaluateTo(&receiver);
+}
+
+bool GismeteoParser::readSearchHTMLData(QXmlQuery query, const ElementIds& ids, const QByteArray& xml,
+                                        QList<XMLMapInfo>& places)
+{
+    gismeteoTrace(Parser) << "readSearchHTMLData()" << xml.size() << "bytes";
+    gismeteoTrace(Payload) << xml;
+
+    if (!query.isValid()) {
+        return false;
+    }
+
+    // Setup model
+    QElapsedTimer timer;
+    timer.start();
+    QLibXmlNodeModel model(query.namePool(), xml, QUrl("file:///search"));
+    query.setFocus(model.dom());
+    GismeteoStats::self()->record(GismeteoStats::DomBuild, timer.nsecsElapsed());
+
+    // Setup a formatter
+    SearchReceiver receiver(ids, places);
+
+    // Evaluate query
+    GismeteoStageTimer evaluateTimer(GismeteoStats::Evaluate);
+    return query.evaluateTo(&receiver);
+}
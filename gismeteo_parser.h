@@ -0,0 +1,88 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* Gismeteo HTML parsers */
+
+#ifndef GISMETEO_PARSER_H
+#define GISMETEO_PARSER_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QXmlName>
+#include <QXmlQuery>
+
+#include "gismeteo_data.h"
+
+// Parsers of Gismeteo pages. They keep no state, so they are safe to run
+// from worker threads as long as each call gets its own query copy.
+class GismeteoParser
+{
+
+public:
+    // Values extracted from the daily page
+    enum Field {
+        NoField,
+        Date,
+        Condition,
+        ConditionIcon,
+        Temperature,
+        Pressure,
+        WindDirection,
+        WindSpeed,
+        Humidity,
+        WaterTemperature,
+        ForecastRecord,         // starts next forecast, has no value
+        ForecastDay,
+        ForecastIcon,
+        ForecastTemperature,
+        HourlyRecord,           // starts next hourly row, has no value
+        HourlyDate,
+        HourlyCondition,
+        HourlyTemperature,
+        HourlyPressure,
+        HourlyWindDirection,
+        HourlyWindSpeed,
+        HourlyHumidity,
+        HourlyComfortTemperature
+    };
+
+    // Ids of elements the queries produce by their names interned into
+    // the name pool of a query, elements we don't know are 0
+    typedef QHash<QXmlName, quint8> ElementIds;
+
+    // Built once per compiled query, shared by all documents parsed with it
+    static ElementIds elementIds(const QXmlNamePool& namePool);
+
+    // Store a value in weather data, stripping units. Shared by all backends.
+    static void setField(WeatherData& data, Field field, QString value);
+
+    // Parse Weather
+    static bool readHTMLData(QXmlQuery query, const ElementIds& ids, const QByteArray& xml, WeatherData& data);
+
+    // Parse search results
+    static bool readSearchHTMLData(QXmlQuery query, const ElementIds& ids, const QByteArray& xml,
+                                   QList<XMLMapInfo>& places);
+
+private:
+    static void setForecastField(WeatherData::Forecast& forecast, Field field, const QString& value);
+    static void setHourlyField(WeatherData::Hourly& hourly, Field field, const QString& value);
+
+};
+
+#endif
@@ -0,0 +1,92 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* Prefix index of Gismeteo places */
+
+#include "gismeteo_placeindex.h"
+
+GismeteoPlaceIndex::GismeteoPlaceIndex(int maxEntries)
+    : m_maxEntries(maxEntries)
+{
+}
+
+QString GismeteoPlaceIndex::normalize(const QString &name)
+{
+    // Russian names are often typed with 'е' instead of 'ё'
+    return name.simplified().toLower().replace(QChar(0x0451), QChar(0x0435));
+}
+
+void GismeteoPlaceIndex::setMaxEntries(int maxEntries)
+{
+    m_maxEntries = qMax(1, maxEntries);
+    trim();
+}
+
+void GismeteoPlaceIndex::add(const QList<XMLMapInfo> &places)
+{
+    foreach (const XMLMapInfo &place, places) {
+        if (place.id == 0) {
+            continue;
+        }
+
+        const QString key = normalize(place.name) + QChar(0) + QString::number(place.id);
+        QMap<QString, Place>::iterator it = m_places.find(key);
+        if (it != m_places.end()) {
+            m_order.erase(it.value().order);
+        } else {
+            it = m_places.insert(key, Place());
+        }
+
+        it.value().info = place;
+        it.value().order = m_order.insert(m_order.begin(), key);
+    }
+
+    trim();
+}
+
+void GismeteoPlaceIndex::trim()
+{
+    while (m_places.size() > m_maxEntries) {
+        m_places.remove(m_order.last());
+        m_order.removeLast();
+    }
+}
+
+QList<XMLMapInfo> GismeteoPlaceIndex::find(const QString &prefix, int limit) const
+{
+    QList<XMLMapInfo> found;
+
+    QMap<QString, Place>::const_iterator it = m_places.lowerBound(prefix);
+    for (; it != m_places.constEnd() && it.key().startsWith(prefix) && found.size() < limit; ++it) {
+        found.append(it.value().info);
+    }
+
+    return found;
+}
+
+void GismeteoPlaceIndex::clear()
+{
+    m_places.clear();
+    m_order.clear();
+}
+
+int GismeteoPlaceIndex::size() const
+{
+    return m_places.size();
+}
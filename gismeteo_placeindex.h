@@ -0,0 +1,69 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* Prefix index of Gismeteo places */
+
+#ifndef GISMETEO_PLACEINDEX_H
+#define GISMETEO_PLACEINDEX_H
+
+#include <QLinkedList>
+#include <QMap>
+
+#include "gismeteo_data.h"
+
+// Places recent searches returned, sorted by normalized name, so that
+// refined searches can be answered without going to network. Keeps at
+// most maxEntries places, evicting ones least recently returned.
+class GismeteoPlaceIndex
+{
+
+public:
+    explicit GismeteoPlaceIndex(int maxEntries = 500);
+
+    // Case and whitespace insensitive form of place name or query
+    static QString normalize(const QString &name);
+
+    void setMaxEntries(int maxEntries);
+
+    void add(const QList<XMLMapInfo> &places);
+
+    // Places with normalized name starting with normalized prefix
+    QList<XMLMapInfo> find(const QString &prefix, int limit = 50) const;
+
+    void clear();
+    int size() const;
+
+private:
+    struct Place {
+        XMLMapInfo info;
+        QLinkedList<QString>::iterator order;
+    };
+
+    void trim();
+
+    // Keyed by normalized name and id
+    QMap<QString, Place> m_places;
+    // Most recently returned first
+    QLinkedList<QString> m_order;
+
+    int m_maxEntries;
+
+};
+
+#endif
@@ -0,0 +1,88 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* Compiled XQuery cache for Gismeteo ion */
+
+#include "gismeteo_querycache.h"
+
+#include <QFile>
+#include <QMutexLocker>
+#include <QUrl>
+
+#include <KDebug>
+
+GismeteoQueryCache::GismeteoQueryCache()
+{
+}
+
+GismeteoCompiledQuery GismeteoQueryCache::query(const QString &fileName)
+{
+    return query(QStringList() << fileName);
+}
+
+GismeteoCompiledQuery GismeteoQueryCache::query(const QStringList &fileNames)
+{
+    QMutexLocker locker(&m_mutex);
+
+    const QString key = fileNames.join("\n");
+    QHash<QString, GismeteoCompiledQuery>::const_iterator it = m_queries.constFind(key);
+    if (it != m_queries.constEnd()) {
+        return it.value();
+    }
+
+    QStringList parts;
+    foreach (const QString &fileName, fileNames) {
+        QFile queryFile(fileName);
+        if (fileName.isEmpty() || !queryFile.open(QIODevice::ReadOnly)) {
+            kDebug() << "Can't open XQuery file" << fileName;
+            return GismeteoCompiledQuery();
+        }
+        parts.append(QString::fromUtf8(queryFile.readAll()));
+    }
+    if (parts.isEmpty()) {
+        return GismeteoCompiledQuery();
+    }
+
+    // setQuery() compiles the query right away, text isn't needed later
+    GismeteoCompiledQuery compiled;
+    compiled.query.setQuery(parts.join(",\n"), QUrl::fromLocalFile(fileNames.first()));
+
+    if (!compiled.query.isValid()) {
+        kDebug() << "query is not valid" << fileNames;
+        return GismeteoCompiledQuery();
+    }
+
+    compiled.elementIds = GismeteoParser::elementIds(compiled.query.namePool());
+    m_queries.insert(key, compiled);
+    return compiled;
+}
+
+void GismeteoQueryCache::invalidate(const QString &fileName)
+{
+    QMutexLocker locker(&m_mutex);
+
+    QHash<QString, GismeteoCompiledQuery>::iterator it = m_queries.begin();
+    while (it != m_queries.end()) {
+        if (it.key().split('\n').contains(fileName)) {
+            it = m_queries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
@@ -0,0 +1,68 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* Compiled XQuery cache for Gismeteo ion */
+
+#ifndef GISMETEO_QUERYCACHE_H
+#define GISMETEO_QUERYCACHE_H
+
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <QXmlQuery>
+
+#include "gismeteo_parser.h"
+
+// Compiled query with ids of its result elements in its name pool
+struct GismeteoCompiledQuery {
+    QXmlQuery query;
+    GismeteoParser::ElementIds elementIds;
+};
+
+// Keeps XQuery programs compiled once per set of files. Callers get a
+// copy of the compiled query which shares the compiled expression and
+// the element ids, so every document only pays for setting the focus
+// and evaluation.
+class GismeteoQueryCache
+{
+
+public:
+    GismeteoQueryCache();
+
+    // Returns compiled query for the file, compiling it on first use.
+    // Returned query is invalid if file can't be read or compiled.
+    GismeteoCompiledQuery query(const QString &fileName);
+
+    // Same for a query made of several files, their expressions are
+    // joined into one sequence in the order given
+    GismeteoCompiledQuery query(const QStringList &fileNames);
+
+    // Drops compiled queries using the file, they will be recompiled on
+    // next use
+    void invalidate(const QString &fileName);
+
+private:
+    QMutex m_mutex;
+    // By file names joined with newlines
+    QHash<QString, GismeteoCompiledQuery> m_queries;
+
+};
+
+#endif
@@ -0,0 +1,189 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* Fetch scheduler of Gismeteo ion */
+
+#include "gismeteo_scheduler.h"
+#include "gismeteo_stats.h"
+
+#include <stdlib.h>
+
+GismeteoFetchScheduler::GismeteoFetchScheduler(QObject *parent)
+    : QObject(parent),
+      m_maxConcurrent(4),
+      m_hostInterval(100),
+      m_jitter(2000),
+      m_suspended(false),
+      m_sequence(0)
+{
+    m_clock.start();
+    m_timer.setSingleShot(true);
+    connect(&m_timer, SIGNAL(timeout()), this, SLOT(dispatch()));
+}
+
+void GismeteoFetchScheduler::setMaxConcurrent(int max)
+{
+    m_maxConcurrent = qMax(1, max);
+    dispatch();
+}
+
+void GismeteoFetchScheduler::setHostInterval(int msecs)
+{
+    m_hostInterval = qMax(0, msecs);
+}
+
+void GismeteoFetchScheduler::setJitter(int msecs)
+{
+    m_jitter = qMax(0, msecs);
+}
+
+void GismeteoFetchScheduler::setSuspended(bool suspended)
+{
+    if (m_suspended == suspended) {
+        return;
+    }
+    m_suspended = suspended;
+
+    if (m_suspended) {
+        m_timer.stop();
+        return;
+    }
+
+    const qint64 now = m_clock.elapsed();
+    const QHash<QString, Queue> background = m_queues[Background];
+    m_queues[Background].clear();
+    foreach (const Queue &queue, background) {
+        foreach (const QString &id, queue) {
+            Request request = m_queued.value(id);
+            enqueue(id, request, now + (m_jitter > 0 ? qrand() % (m_jitter + 1) : 0));
+        }
+    }
+    dispatch();
+}
+
+bool GismeteoFetchScheduler::isSuspended() const
+{
+    return m_suspended;
+}
+
+void GismeteoFetchScheduler::schedule(const QString &id, const KUrl &url, Priority priority)
+{
+    if (m_running.contains(id) || m_queued.contains(id)) {
+        return;
+    }
+
+    Request request;
+    request.url = url;
+    request.priority = priority;
+    request.queuedAt = m_clock.elapsed();
+    qint64 notBefore = request.queuedAt;
+    if (priority == Background && m_jitter > 0) {
+        notBefore += qrand() % (m_jitter + 1);
+    }
+    enqueue(id, request, notBefore);
+
+    dispatch();
+}
+
+void GismeteoFetchScheduler::cancel(const QString &id)
+{
+    QHash<QString, Request>::iterator it = m_queued.find(id);
+    if (it != m_queued.end()) {
+        dequeue(it.value());
+        m_queued.erase(it);
+    }
+}
+
+void GismeteoFetchScheduler::finished(const QString &id)
+{
+    if (m_running.remove(id)) {
+        dispatch();
+    }
+}
+
+void GismeteoFetchScheduler::enqueue(const QString &id, Request &request, qint64 notBefore)
+{
+    request.order = Order(notBefore, m_sequence++);
+    m_queues[request.priority][request.url.host()].insert(request.order, id);
+    m_queued.insert(id, request);
+}
+
+void GismeteoFetchScheduler::dequeue(const Request &request)
+{
+    QHash<QString, Queue> &hosts = m_queues[request.priority];
+    QHash<QString, Queue>::iterator host = hosts.find(request.url.host());
+    if (host == hosts.end()) {
+        return;
+    }
+    host.value().remove(request.order);
+    if (host.value().isEmpty()) {
+        hosts.erase(host);
+    }
+}
+
+void GismeteoFetchScheduler::dispatch()
+{
+    if (m_suspended) {
+        return;
+    }
+
+    while (m_running.size() < m_maxConcurrent) {
+        const qint64 now = m_clock.elapsed();
+        qint64 wakeUp = -1;
+        QString next;
+        Order nextOrder;
+
+        // Earliest request that may go now, in priority order. Rest of
+        // a host queue can't go before its first request.
+        for (int priority = 0; priority < PriorityCount && next.isEmpty(); ++priority) {
+            const QHash<QString, Queue> &hosts = m_queues[priority];
+            for (QHash<QString, Queue>::const_iterator host = hosts.constBegin(); host != hosts.constEnd(); ++host) {
+                const Queue::const_iterator first = host.value().constBegin();
+                const qint64 readyAt = qMax(first.key().first, m_hostReady.value(host.key(), 0));
+                if (readyAt > now) {
+                    if (wakeUp < 0 || readyAt < wakeUp) {
+                        wakeUp = readyAt;
+                    }
+                    continue;
+                }
+                if (next.isEmpty() || first.key() < nextOrder) {
+                    next = first.value();
+                    nextOrder = first.key();
+                }
+            }
+        }
+
+        if (next.isEmpty()) {
+            if (wakeUp >= 0) {
+                m_timer.start(wakeUp - now);
+            }
+            return;
+        }
+
+        const Request request = m_queued.take(next);
+        dequeue(request);
+        m_running.insert(next);
+        m_hostReady.insert(request.url.host(), now + m_hostInterval);
+        GismeteoStats::self()->record(GismeteoStats::Queue, (now - request.queuedAt) * 1000000);
+
+        emit ready(next, request.url);
+    }
+}
+
+#include "gismeteo_scheduler.moc"
@@ -0,0 +1,114 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* Fetch scheduler of Gismeteo ion */
+
+#ifndef GISMETEO_SCHEDULER_H
+#define GISMETEO_SCHEDULER_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMap>
+#include <QObject>
+#include <QPair>
+#include <QSet>
+#include <QTimer>
+
+#include <KUrl>
+
+// Decides when downloads may start. At most maxConcurrent requests run
+// at once, interactive ones go before background ones, requests to the
+// same host are spaced by hostInterval and background requests are
+// delayed by a random jitter to spread refreshes that come together.
+// The owner starts the download on ready() and reports back with
+// finished().
+class GismeteoFetchScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Priority {
+        Interactive,        // place search, user is waiting
+        Background,         // weather refresh
+        PriorityCount
+    };
+
+    explicit GismeteoFetchScheduler(QObject *parent = 0);
+
+    void setMaxConcurrent(int max);
+    void setHostInterval(int msecs);
+    void setJitter(int msecs);
+
+    // Nothing starts while suspended. On resume background requests are
+    // spread over the jitter interval again, so catch-up isn't a burst.
+    void setSuspended(bool suspended);
+    bool isSuspended() const;
+
+    // Queue a request, ignored if the id is already queued or running
+    void schedule(const QString &id, const KUrl &url, Priority priority);
+
+    // Drop queued request, running one is not affected
+    void cancel(const QString &id);
+
+    // Started request is over, next one may start
+    void finished(const QString &id);
+
+Q_SIGNALS:
+    void ready(const QString &id, const KUrl &url);
+
+private Q_SLOTS:
+    void dispatch();
+
+private:
+    // Requests wait in order of time they may start, in scheduler clock,
+    // then in order of arrival
+    typedef QPair<qint64, quint64> Order;
+    typedef QMap<Order, QString> Queue;
+
+    struct Request {
+        KUrl url;
+        Priority priority;
+        Order order;
+        qint64 queuedAt;
+    };
+
+    void enqueue(const QString &id, Request &request, qint64 notBefore);
+    void dequeue(const Request &request);
+
+    int m_maxConcurrent;
+    int m_hostInterval;
+    int m_jitter;
+    bool m_suspended;
+
+    QElapsedTimer m_clock;
+    QTimer m_timer;
+
+    // Queued requests by id, their ids by priority and host. Only the
+    // first id of each host queue is looked at to find the next request.
+    QHash<QString, Request> m_queued;
+    QHash<QString, Queue> m_queues[PriorityCount];
+    quint64 m_sequence;
+    QSet<QString> m_running;
+
+    // Earliest time the next request may go to the host
+    QHash<QString, qint64> m_hostReady;
+
+};
+
+#endif
@@ -0,0 +1,232 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* Cuts sections with values out of a raw Gismeteo page */
+
+#include "gismeteo_sectionfilter.h"
+
+#include <string.h>
+
+#include "gismeteo_trace.h"
+
+namespace {
+
+// Attribute as written on the page, with either quote
+struct SectionId {
+    const char *doubleQuoted;
+    const char *singleQuoted;
+};
+
+const SectionId sectionIds[] = {
+    { "id=\"weather\"",       "id='weather'" },
+    { "id=\"water\"",         "id='water'" },
+    { "id=\"astronomy\"",     "id='astronomy'" },
+    { "id=\"weather-daily\"", "id='weather-daily'" }
+};
+
+const int sectionCount = sizeof(sectionIds) / sizeof(sectionIds[0]);
+
+// Page is UTF-8, the meta tag saying so is left behind with the head
+const char documentStart[] =
+    "<html><head><meta http-equiv=\"Content-Type\" content=\"text/html; charset=utf-8\"></head><body>";
+const char documentEnd[] = "</body></html>";
+
+struct Fragment {
+    const char *begin;
+    const char *end;
+};
+
+inline bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+}
+
+// memmem() and memchr() are vectorized in libc, the page is mostly
+// skipped by them without looking at every byte here
+inline const char *find(const char *begin, const char *end, const char *needle)
+{
+    const int size = qstrlen(needle);
+    if (end - begin < size) {
+        return 0;
+    }
+    return static_cast<const char *>(memmem(begin, end - begin, needle, size));
+}
+
+// Case insensitive search for a string starting with '<'
+const char *findTag(const char *begin, const char *end, const char *tag)
+{
+    const int size = qstrlen(tag);
+    for (const char *p = begin; p < end; ++p) {
+        p = static_cast<const char *>(memchr(p, '<', end - p));
+        if (!p || end - p < size) {
+            return 0;
+        }
+        if (qstrnicmp(p, tag, size) == 0) {
+            return p;
+        }
+    }
+    return 0;
+}
+
+// True if p starts a tag with this name, like <div> or </div
+inline bool isTag(const char *p, const char *end, const char *name, int size)
+{
+    return end - p > size && qstrnicmp(p, name, size) == 0 &&
+           (isSpace(p[size]) || p[size] == '>' || p[size] == '/');
+}
+
+// Start of div tag holding the attribute found at pos, 0 if it's not a div
+const char *divStart(const char *begin, const char *pos)
+{
+    const char *p = pos;
+    while (p > begin && *p != '<' && *p != '>') {
+        --p;
+    }
+    if (*p != '<' || !isTag(p, pos, "<div", 4)) {
+        return 0;
+    }
+    return p;
+}
+
+// Just past the end tag closing the div started at begin, 0 if the page
+// ends before it. Comments, scripts and styles may hold anything, they are
+// skipped.
+const char *divEnd(const char *begin, const char *end)
+{
+    int depth = 0;
+    const char *p = begin;
+
+    while (p < end) {
+        p = static_cast<const char *>(memchr(p, '<', end - p));
+        if (!p) {
+            return 0;
+        }
+
+        if (end - p >= 4 && p[1] == '!' && p[2] == '-' && p[3] == '-') {
+            p = find(p + 4, end, "-->");
+            if (!p) {
+                return 0;
+            }
+            p += 3;
+            continue;
+        }
+
+        if (isTag(p, end, "<script", 7)) {
+            p = findTag(p + 7, end, "</script");
+            if (!p) {
+                return 0;
+            }
+            p += 8;
+            continue;
+        }
+
+        if (isTag(p, end, "<style", 6)) {
+            p = findTag(p + 6, end, "</style");
+            if (!p) {
+                return 0;
+            }
+            p += 7;
+            continue;
+        }
+
+        if (isTag(p, end, "<div", 4)) {
+            ++depth;
+        } else if (isTag(p, end, "</div", 5) && --depth == 0) {
+            const char *gt = static_cast<const char *>(memchr(p, '>', end - p));
+            return gt ? gt + 1 : 0;
+        }
+        ++p;
+    }
+    return 0;
+}
+
+// Element with the attribute, tries both quotes
+Fragment findSection(const char *begin, const char *end, const SectionId &id)
+{
+    const char *const needles[2] = { id.doubleQuoted, id.singleQuoted };
+    Fragment fragment = { 0, 0 };
+
+    // Same text may come earlier in a script or style, it's not a closed div there
+    for (int i = 0; i < 2; ++i) {
+        for (const char *pos = find(begin, end, needles[i]); pos; pos = find(pos + 1, end, needles[i])) {
+            const char *start = divStart(begin, pos);
+            const char *stop = start ? divEnd(start, end) : 0;
+            if (stop) {
+                fragment.begin = start;
+                fragment.end = stop;
+                return fragment;
+            }
+        }
+    }
+    return fragment;
+}
+
+}
+
+QByteArray GismeteoSectionFilter::filter(const QByteArray &html)
+{
+    const char *const data = html.constData();
+    const char *const end = data + html.size();
+
+    // Sections in page order
+    Fragment fragments[sectionCount];
+    int count = 0;
+    int size = 0;
+
+    for (int i = 0; i < sectionCount; ++i) {
+        const Fragment fragment = findSection(data, end, sectionIds[i]);
+        if (!fragment.begin) {
+            // No current weather, let the queries see what the page has
+            if (i == 0) {
+                gismeteoTrace(Parser) << "No weather section, page is not filtered";
+                return html;
+            }
+            continue;
+        }
+
+        int j = count;
+        while (j > 0 && fragments[j - 1].begin > fragment.begin) {
+            fragments[j] = fragments[j - 1];
+            --j;
+        }
+        fragments[j] = fragment;
+        ++count;
+    }
+
+    // A section nested in another one comes with it
+    int kept = 0;
+    for (int i = 0; i < count; ++i) {
+        if (kept > 0 && fragments[i].begin < fragments[kept - 1].end) {
+            continue;
+        }
+        fragments[kept++] = fragments[i];
+        size += fragments[i].end - fragments[i].begin;
+    }
+
+    QByteArray result;
+    result.reserve(sizeof(documentStart) + size + sizeof(documentEnd));
+    result.append(documentStart);
+    for (int i = 0; i < kept; ++i) {
+        result.append(fragments[i].begin, fragments[i].end - fragments[i].begin);
+    }
+    result.append(documentEnd);
+
+    gismeteoTrace(Parser) << "Section filter kept" << result.size() << "of" << html.size() << "bytes";
+    return result;
+}
@@ -0,0 +1,42 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* Cuts sections with values out of a raw Gismeteo page */
+
+#ifndef GISMETEO_SECTIONFILTER_H
+#define GISMETEO_SECTIONFILTER_H
+
+#include <QByteArray>
+
+// Most of a daily page is scripts, ads and navigation the queries never
+// look at. Before the page goes to libxml, the div elements holding the
+// values are found with plain byte searches and put into an otherwise
+// empty document, so the DOM has only the nodes we read.
+class GismeteoSectionFilter
+{
+
+public:
+    // Document with weather, water, astronomy and weather-daily
+    // sections of the page, or the page itself if there is no
+    // current weather section in it
+    static QByteArray filter(const QByteArray &html);
+
+};
+
+#endif
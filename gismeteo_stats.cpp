@@ -0,0 +1,153 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* Latency and throughput statistics of Gismeteo ion */
+
+#include "gismeteo_stats.h"
+
+#include <QMutexLocker>
+#include <QtAlgorithms>
+
+GismeteoStats::GismeteoStats()
+{
+    clear();
+}
+
+GismeteoStats *GismeteoStats::self()
+{
+    static GismeteoStats stats;
+    return &stats;
+}
+
+void GismeteoStats::record(Stage stage, qint64 nsecs)
+{
+    QMutexLocker locker(&m_mutex);
+
+    // Ring buffer of recent samples, the oldest one is overwritten
+    QVector<qint64> &samples = m_samples[stage];
+    if (samples.size() < WindowSize) {
+        samples.append(nsecs);
+    } else {
+        samples[m_counts[stage] % WindowSize] = nsecs;
+    }
+    ++m_counts[stage];
+}
+
+void GismeteoStats::add(Counter counter, qint64 value)
+{
+    QMutexLocker locker(&m_mutex);
+    m_counters[counter] += value;
+}
+
+GismeteoStats::Summary GismeteoStats::summary(Stage stage) const
+{
+    QMutexLocker locker(&m_mutex);
+
+    Summary summary;
+    summary.count = m_counts[stage];
+    summary.p50 = summary.p95 = summary.p99 = summary.max = 0;
+
+    QVector<qint64> samples = m_samples[stage];
+    locker.unlock();
+
+    if (samples.isEmpty()) {
+        return summary;
+    }
+
+    qSort(samples);
+    const int last = samples.size() - 1;
+    summary.p50 = samples.at(last * 50 / 100);
+    summary.p95 = samples.at(last * 95 / 100);
+    summary.p99 = samples.at(last * 99 / 100);
+    summary.max = samples.at(last);
+    return summary;
+}
+
+qint64 GismeteoStats::counter(Counter counter) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_counters[counter];
+}
+
+const char *GismeteoStats::stageName(Stage stage)
+{
+    static const char * const names[StageCount] = {
+        "Queue",
+        "Connect",
+        "Transfer",
+        "Stream Parse",
+        "DOM Build",
+        "Evaluate",
+        "Publish"
+    };
+    return names[stage];
+}
+
+const char *GismeteoStats::counterName(Counter counter)
+{
+    static const char * const names[CounterCount] = {
+        "Bytes Received",
+        "Weather Pages",
+        "Search Pages"
+    };
+    return names[counter];
+}
+
+void GismeteoStats::clear()
+{
+    QMutexLocker locker(&m_mutex);
+
+    for (int i = 0; i < StageCount; ++i) {
+        m_samples[i].clear();
+        m_samples[i].reserve(WindowSize);
+        m_counts[i] = 0;
+    }
+    for (int i = 0; i < CounterCount; ++i) {
+        m_counters[i] = 0;
+    }
+}
+
+GismeteoTransferTimer::GismeteoTransferTimer()
+    : m_receiving(false)
+{
+}
+
+void GismeteoTransferTimer::start()
+{
+    m_timer.start();
+    m_receiving = false;
+}
+
+void GismeteoTransferTimer::received(int bytes)
+{
+    if (!m_receiving && m_timer.isValid()) {
+        GismeteoStats::self()->record(GismeteoStats::Connect, m_timer.nsecsElapsed());
+        m_timer.restart();
+        m_receiving = true;
+    }
+    GismeteoStats::self()->add(GismeteoStats::BytesReceived, bytes);
+}
+
+void GismeteoTransferTimer::finish()
+{
+    if (m_receiving) {
+        GismeteoStats::self()->record(GismeteoStats::Transfer, m_timer.nsecsElapsed());
+        m_receiving = false;
+    }
+}
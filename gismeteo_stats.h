@@ -0,0 +1,127 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* Latency and throughput statistics of Gismeteo ion */
+
+#ifndef GISMETEO_STATS_H
+#define GISMETEO_STATS_H
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QVector>
+
+// Process wide latency histograms and byte counters. Every stage keeps
+// its most recent samples, percentiles are computed on request only.
+// Safe to record from parser worker threads.
+class GismeteoStats
+{
+
+public:
+    enum Stage {
+        Queue,                  // waiting for fetch scheduler
+        Connect,                // request sent until first data, DNS and connect included
+        Transfer,               // first data until the job is over
+        StreamParse,            // time in stream parser per page
+        DomBuild,               // libxml2 tree for XQuery backend
+        Evaluate,               // XQuery evaluation and receiver dispatch
+        Publish,                // building and setting engine data
+        StageCount
+    };
+
+    enum Counter {
+        BytesReceived,
+        WeatherPages,
+        SearchPages,
+        CounterCount
+    };
+
+    struct Summary
+    {
+        qint64 count;           // samples recorded ever
+        qint64 p50;             // nanoseconds, over recent samples
+        qint64 p95;
+        qint64 p99;
+        qint64 max;
+    };
+
+    static GismeteoStats *self();
+
+    void record(Stage stage, qint64 nsecs);
+    void add(Counter counter, qint64 value = 1);
+
+    Summary summary(Stage stage) const;
+    qint64 counter(Counter counter) const;
+
+    static const char *stageName(Stage stage);
+    static const char *counterName(Counter counter);
+
+    void clear();
+
+private:
+    enum { WindowSize = 512 };
+
+    GismeteoStats();
+
+    mutable QMutex m_mutex;
+    QVector<qint64> m_samples[StageCount];
+    qint64 m_counts[StageCount];
+    qint64 m_counters[CounterCount];
+
+};
+
+// Records time spent in a scope
+class GismeteoStageTimer
+{
+
+public:
+    explicit GismeteoStageTimer(GismeteoStats::Stage stage)
+        : m_stage(stage)
+    {
+        m_timer.start();
+    }
+
+    ~GismeteoStageTimer()
+    {
+        GismeteoStats::self()->record(m_stage, m_timer.nsecsElapsed());
+    }
+
+private:
+    GismeteoStats::Stage m_stage;
+    QElapsedTimer m_timer;
+
+};
+
+// Connect and transfer time of one download
+class GismeteoTransferTimer
+{
+
+public:
+    GismeteoTransferTimer();
+
+    void start();
+    void received(int bytes);
+    void finish();
+
+private:
+    QElapsedTimer m_timer;
+    bool m_receiving;
+
+};
+
+#endif
@@ -0,0 +1,749 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* Incremental HTML tokenizer and streaming extractor for Gismeteo pages */
+
+#include "gismeteo_streamparser.h"
+
+#include <string.h>
+
+namespace {
+
+struct TagInfo {
+    const char *name;
+    GismeteoHtmlTokenizer::Tag tag;
+    bool isVoid;
+};
+
+const TagInfo tagTable[] = {
+    { "a",      GismeteoHtmlTokenizer::A,      false },
+    { "area",   GismeteoHtmlTokenizer::Area,   true  },
+    { "base",   GismeteoHtmlTokenizer::Base,   true  },
+    { "body",   GismeteoHtmlTokenizer::Body,   false },
+    { "br",     GismeteoHtmlTokenizer::Br,     true  },
+    { "col",    GismeteoHtmlTokenizer::Col,    true  },
+    { "dd",     GismeteoHtmlTokenizer::Dd,     false },
+    { "div",    GismeteoHtmlTokenizer::Div,    false },
+    { "dl",     GismeteoHtmlTokenizer::Dl,     false },
+    { "dt",     GismeteoHtmlTokenizer::Dt,     false },
+    { "embed",  GismeteoHtmlTokenizer::Embed,  true  },
+    { "h6",     GismeteoHtmlTokenizer::H6,     false },
+    { "head",   GismeteoHtmlTokenizer::Head,   false },
+    { "hr",     GismeteoHtmlTokenizer::Hr,     true  },
+    { "html",   GismeteoHtmlTokenizer::Html,   false },
+    { "img",    GismeteoHtmlTokenizer::Img,    true  },
+    { "input",  GismeteoHtmlTokenizer::Input,  true  },
+    { "li",     GismeteoHtmlTokenizer::Li,     false },
+    { "link",   GismeteoHtmlTokenizer::Link,   true  },
+    { "meta",   GismeteoHtmlTokenizer::Meta,   true  },
+    { "p",      GismeteoHtmlTokenizer::P,      false },
+    { "param",  GismeteoHtmlTokenizer::Param,  true  },
+    { "script", GismeteoHtmlTokenizer::Script, false },
+    { "source", GismeteoHtmlTokenizer::Source, true  },
+    { "span",   GismeteoHtmlTokenizer::Span,   false },
+    { "style",  GismeteoHtmlTokenizer::Style,  false },
+    { "table",  GismeteoHtmlTokenizer::Table,  false },
+    { "tbody",  GismeteoHtmlTokenizer::Tbody,  false },
+    { "td",     GismeteoHtmlTokenizer::Td,     false },
+    { "th",     GismeteoHtmlTokenizer::Th,     false },
+    { "thead",  GismeteoHtmlTokenizer::Thead,  false },
+    { "tr",     GismeteoHtmlTokenizer::Tr,     false },
+    { "ul",     GismeteoHtmlTokenizer::Ul,     false },
+    { "wbr",    GismeteoHtmlTokenizer::Wbr,    true  }
+};
+
+const int tagTableSize = sizeof(tagTable) / sizeof(tagTable[0]);
+
+struct EntityInfo {
+    const char *name;
+    ushort unicode;
+};
+
+const EntityInfo entityTable[] = {
+    { "amp",    0x0026 },
+    { "apos",   0x0027 },
+    { "deg",    0x00B0 },
+    { "gt",     0x003E },
+    { "hellip", 0x2026 },
+    { "laquo",  0x00AB },
+    { "lt",     0x003C },
+    { "mdash",  0x2014 },
+    { "middot", 0x00B7 },
+    { "minus",  0x2212 },
+    { "nbsp",   0x00A0 },
+    { "ndash",  0x2013 },
+    { "quot",   0x0022 },
+    { "raquo",  0x00BB }
+};
+
+const int entityTableSize = sizeof(entityTable) / sizeof(entityTable[0]);
+
+inline bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+}
+
+inline bool isAlpha(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+inline bool isNameChar(char c)
+{
+    return isAlpha(c) || (c >= '0' && c <= '9') || c == '-' || c == '_' || c == ':';
+}
+
+// Step of a path from section root, like div[2] or //h6
+struct PathStep {
+    GismeteoHtmlTokenizer::Tag tag;
+    quint8 position;            // 0 matches any position
+    bool descendant;            // step is preceded by //
+};
+
+// Value location, generated from a query
+struct PathRule {
+    GismeteoStreamParser::Section section;
+    int stepCount;
+    PathStep steps[8];
+    const char *attribute;      // 0 to take text of element
+    const char *after;          // substring-after() argument
+    const char *before;         // substring-before() argument
+    GismeteoParser::Field field;
+};
+
+#define STEP(tag) { GismeteoHtmlTokenizer::tag, 0, false }
+#define STEP_AT(tag, position) { GismeteoHtmlTokenizer::tag, position, false }
+#define STEP_ANY(tag) { GismeteoHtmlTokenizer::tag, 0, true }
+
+// dailyRules from gismeteo.xq and hourlyRules from gismeteo-hourly.xq,
+// written by gismeteo-xq2cpp at build time. Hourly rules only cover the
+// hourly table, they are matched in addition to daily ones.
+#include "gismeteo_xqrules.h"
+
+#undef STEP
+#undef STEP_AT
+#undef STEP_ANY
+
+const char *const sectionIds[GismeteoStreamParser::SectionCount] = {
+    "weather",
+    "water",
+    "astronomy",
+    "weather-daily"
+};
+
+}
+
+GismeteoHtmlTokenizer::GismeteoHtmlTokenizer()
+    : m_skipUntil(0), m_skipConsume(false)
+{
+}
+
+GismeteoHtmlTokenizer::~GismeteoHtmlTokenizer()
+{
+}
+
+void GismeteoHtmlTokenizer::feed(const QByteArray &data)
+{
+    feed(data.constData(), data.size());
+}
+
+void GismeteoHtmlTokenizer::feed(const char *data, int size)
+{
+    if (m_pending.isEmpty()) {
+        const int used = process(data, size);
+        if (used < size) {
+            m_pending = QByteArray(data + used, size - used);
+        }
+        return;
+    }
+
+    m_pending.append(data, size);
+    const QByteArray buffer = m_pending;
+    const int used = process(buffer.constData(), buffer.size());
+    m_pending = buffer.mid(used);
+}
+
+void GismeteoHtmlTokenizer::finish()
+{
+    m_pending.clear();
+    m_skipUntil = 0;
+}
+
+GismeteoHtmlTokenizer::Tag GismeteoHtmlTokenizer::tag(const char *name, int size)
+{
+    for (int i = 0; i < tagTableSize; ++i) {
+        const char *tagName = tagTable[i].name;
+        if ((tagName[0] == name[0] || tagName[0] == (name[0] | 0x20)) &&
+            qstrnicmp(tagName, name, size) == 0 && tagName[size] == '\0') {
+            return tagTable[i].tag;
+        }
+    }
+    return OtherTag;
+}
+
+bool GismeteoHtmlTokenizer::isVoid(Tag tag)
+{
+    for (int i = 0; i < tagTableSize; ++i) {
+        if (tagTable[i].tag == tag) {
+            return tagTable[i].isVoid;
+        }
+    }
+    return false;
+}
+
+QByteArray GismeteoHtmlTokenizer::attribute(const char *attrs, int size, const char *name)
+{
+    const char *p = attrs;
+    const char *const end = attrs + size;
+    const int nameSize = qstrlen(name);
+
+    while (p < end) {
+        const char *start = p;
+
+        while (p < end && (isSpace(*p) || *p == '/')) {
+            ++p;
+        }
+
+        const char *attrName = p;
+        while (p < end && !isSpace(*p) && *p != '=' && *p != '/') {
+            ++p;
+        }
+        const int attrNameSize = p - attrName;
+
+        while (p < end && isSpace(*p)) {
+            ++p;
+        }
+
+        const char *value = 0;
+        int valueSize = 0;
+        if (p < end && *p == '=') {
+            ++p;
+            while (p < end && isSpace(*p)) {
+                ++p;
+            }
+            if (p < end && (*p == '"' || *p == '\'')) {
+                const char quote = *p++;
+                value = p;
+                while (p < end && *p != quote) {
+                    ++p;
+                }
+                valueSize = p - value;
+                if (p < end) {
+                    ++p;
+                }
+            } else {
+                value = p;
+                while (p < end && !isSpace(*p)) {
+                    ++p;
+                }
+                valueSize = p - value;
+            }
+        }
+
+        if (attrNameSize == nameSize && qstrnicmp(attrName, name, nameSize) == 0) {
+            return QByteArray(value, valueSize);
+        }
+
+        if (p == start) {
+            ++p;
+        }
+    }
+
+    return QByteArray();
+}
+
+QString GismeteoHtmlTokenizer::decode(const QByteArray &text)
+{
+    QString result = QString::fromUtf8(text.constData(), text.size());
+    if (!text.contains('&')) {
+        return result;
+    }
+
+    int pos = 0;
+    while ((pos = result.indexOf('&', pos)) != -1) {
+        const int semicolon = result.indexOf(';', pos + 1);
+        if (semicolon == -1 || semicolon - pos > 10) {
+            ++pos;
+            continue;
+        }
+
+        const QString entity = result.mid(pos + 1, semicolon - pos - 1);
+        uint unicode = 0;
+        bool ok = false;
+
+        if (entity.startsWith('#')) {
+            if (entity.size() > 1 && (entity.at(1) == 'x' || entity.at(1) == 'X')) {
+                unicode = entity.mid(2).toUInt(&ok, 16);
+            } else {
+                unicode = entity.mid(1).toUInt(&ok, 10);
+            }
+            ok = ok && unicode > 0 && unicode < 0x10000;
+        } else {
+            for (int i = 0; i < entityTableSize; ++i) {
+                if (entity == QLatin1String(entityTable[i].name)) {
+                    unicode = entityTable[i].unicode;
+                    ok = true;
+                    break;
+                }
+            }
+        }
+
+        if (ok) {
+            result.replace(pos, semicolon - pos + 1, QChar(unicode));
+        }
+        ++pos;
+    }
+
+    return result;
+}
+
+// Tag is too long to be real markup, it is dropped up to its '>'
+void GismeteoHtmlTokenizer::skipLongTag()
+{
+    m_skipUntil = ">";
+    m_skipConsume = true;
+}
+
+const char *GismeteoHtmlTokenizer::findTerminator(const char *begin, const char *end) const
+{
+    const int size = qstrlen(m_skipUntil);
+    const char first = m_skipUntil[0];
+
+    for (const char *p = begin; p < end; ++p) {
+        p = static_cast<const char *>(memchr(p, first, end - p));
+        if (!p || end - p < size) {
+            return 0;
+        }
+        if (qstrnicmp(p, m_skipUntil, size) == 0) {
+            return p;
+        }
+    }
+    return 0;
+}
+
+int GismeteoHtmlTokenizer::process(const char *data, int size)
+{
+    const char *p = data;
+    const char *const end = data + size;
+
+    while (p < end) {
+        // Inside comment, script or style
+        if (m_skipUntil) {
+            const char *found = findTerminator(p, end);
+            if (!found) {
+                // Keep the tail, it may hold beginning of terminator
+                const int keep = qMin<int>(end - p, qstrlen(m_skipUntil) - 1);
+                return size - keep;
+            }
+            p = m_skipConsume ? found + qstrlen(m_skipUntil) : found;
+            m_skipUntil = 0;
+            continue;
+        }
+
+        // Text
+        if (*p != '<') {
+            const char *lt = static_cast<const char *>(memchr(p, '<', end - p));
+            const char *textEnd = lt ? lt : end;
+            characters(p, textEnd - p);
+            p = textEnd;
+            continue;
+        }
+
+        if (end - p < 2) {
+            return p - data;
+        }
+
+        // Comment, doctype or processing instruction
+        if (p[1] == '!' || p[1] == '?') {
+            if (end - p < 4) {
+                return p - data;
+            }
+            if (p[1] == '!' && p[2] == '-' && p[3] == '-') {
+                m_skipUntil = "-->";
+                m_skipConsume = true;
+                p += 4;
+                continue;
+            }
+            const char *gt = static_cast<const char *>(memchr(p, '>', end - p));
+            if (!gt) {
+                if (end - p <= MaxTagSize) {
+                    return p - data;
+                }
+                skipLongTag();
+                p = end;
+                continue;
+            }
+            p = gt + 1;
+            continue;
+        }
+
+        // End tag
+        if (p[1] == '/') {
+            const char *gt = static_cast<const char *>(memchr(p, '>', end - p));
+            if (!gt) {
+                if (end - p <= MaxTagSize) {
+                    return p - data;
+                }
+                skipLongTag();
+                p = end;
+                continue;
+            }
+            const char *name = p + 2;
+            const char *nameEnd = name;
+            while (nameEnd < gt && isNameChar(*nameEnd)) {
+                ++nameEnd;
+            }
+            if (nameEnd > name) {
+                const Tag endTag = tag(name, nameEnd - name);
+                if (!isVoid(endTag)) {
+                    endElement(endTag);
+                }
+            }
+            p = gt + 1;
+            continue;
+        }
+
+        // Stray '<'
+        if (!isAlpha(p[1])) {
+            characters(p, 1);
+            ++p;
+            continue;
+        }
+
+        // Start tag, '>' may appear in quoted attribute values
+        const char *q = p + 2;
+        char quote = 0;
+        for (; q < end; ++q) {
+            if (quote) {
+                if (*q == quote) {
+                    quote = 0;
+                }
+            } else if (*q == '"' || *q == '\'') {
+                quote = *q;
+            } else if (*q == '>') {
+                break;
+            }
+        }
+        if (q == end) {
+            if (end - p <= MaxTagSize) {
+                return p - data;
+            }
+
+            // Quote left open would hold the rest of the page, so
+            // quotes are ignored and the tag ends at the first '>'
+            q = static_cast<const char *>(memchr(p + 2, '>', end - p - 2));
+            if (!q) {
+                skipLongTag();
+                p = end;
+                continue;
+            }
+        }
+
+        const char *name = p + 1;
+        const char *nameEnd = name;
+        while (nameEnd < q && isNameChar(*nameEnd)) {
+            ++nameEnd;
+        }
+        const Tag startTag = tag(name, nameEnd - name);
+        const bool selfClosing = q[-1] == '/';
+
+        startElement(startTag, nameEnd, (selfClosing ? q - 1 : q) - nameEnd);
+
+        if (selfClosing || isVoid(startTag)) {
+            endElement(startTag);
+        } else if (startTag == Script) {
+            m_skipUntil = "</script";
+            m_skipConsume = false;
+        } else if (startTag == Style) {
+            m_skipUntil = "</style";
+            m_skipConsume = false;
+        }
+
+        p = q + 1;
+    }
+
+    return p - data;
+}
+
+
+GismeteoStreamParser::GismeteoStreamParser(bool hourly)
+    : m_depth(0),
+      m_overflow(0),
+      m_hourly(hourly),
+      m_seenSections(0),
+      m_captureField(GismeteoParser::NoField),
+      m_captureDepth(-1)
+{
+    for (int i = 0; i < SectionCount; ++i) {
+        m_sectionRoot[i] = -1;
+    }
+    m_data.hasHourly = hourly;
+}
+
+const WeatherData &GismeteoStreamParser::weatherData() const
+{
+    return m_data;
+}
+
+bool GismeteoStreamParser::isValid() const
+{
+    return m_seenSections & (1 << WeatherSection);
+}
+
+bool GismeteoStreamParser::isComplete() const
+{
+    const quint8 required = requiredSections();
+    return (m_seenSections & required) == required;
+}
+
+quint8 GismeteoStreamParser::requiredSections()
+{
+    static quint8 sections = 0;
+    if (!sections) {
+        for (int i = 0; i < dailyRulesCount; ++i) {
+            sections |= 1 << dailyRules[i].section;
+        }
+        // Without rules we don't know, wait for every section
+        if (!dailyRulesComplete) {
+            sections = (1 << SectionCount) - 1;
+        }
+    }
+    return sections;
+}
+
+bool GismeteoStreamParser::isSupported(bool hourly)
+{
+    return dailyRulesComplete && (!hourly || hourlyRulesComplete);
+}
+
+void GismeteoStreamParser::push(Tag tag, int section)
+{
+    Frame &frame = m_frames[m_depth];
+    frame.tag = tag;
+    frame.section = section;
+    frame.index = m_depth > 0 ? ++m_frames[m_depth - 1].counts[tag] : 1;
+    memset(frame.counts, 0, sizeof(frame.counts));
+
+    if (section >= 0) {
+        m_sectionRoot[section] = m_depth;
+    }
+
+    ++m_depth;
+}
+
+void GismeteoStreamParser::pop()
+{
+    --m_depth;
+    const Frame &frame = m_frames[m_depth];
+
+    if (m_captureDepth == m_depth) {
+        GismeteoParser::setField(m_data, m_captureField, decode(m_capture).trimmed());
+        m_captureField = GismeteoParser::NoField;
+        m_captureDepth = -1;
+        m_capture.clear();
+    }
+
+    if (frame.section >= 0) {
+        m_sectionRoot[frame.section] = -1;
+        m_seenSections |= 1 << frame.section;
+    }
+}
+
+// Matches steps against frames, last step against last frame
+static bool matchSteps(const PathStep *steps, int stepCount, const quint8 *tags, const quint16 *indexes, int frameCount)
+{
+    if (stepCount == 0) {
+        return frameCount == 0;
+    }
+    if (frameCount == 0) {
+        return false;
+    }
+
+    const PathStep &step = steps[stepCount - 1];
+    if (step.tag != tags[frameCount - 1] ||
+        (step.position && step.position != indexes[frameCount - 1])) {
+        return false;
+    }
+
+    if (!step.descendant) {
+        return matchSteps(steps, stepCount - 1, tags, indexes, frameCount - 1);
+    }
+
+    for (int i = frameCount - 1; i >= stepCount - 1; --i) {
+        if (matchSteps(steps, stepCount - 1, tags, indexes, i)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void GismeteoStreamParser::startElement(Tag tag, const char *attrs, int size)
+{
+    // Implied end tags
+    if (m_depth > 0) {
+        const Tag top = Tag(m_frames[m_depth - 1].tag);
+        if (((tag == Dt || tag == Dd) && (top == Dt || top == Dd)) ||
+            (tag == Li && top == Li) ||
+            ((tag == Td || tag == Th || tag == Tr) && (top == Td || top == Th)) ||
+            (top == P && (tag == P || tag == Div || tag == Dl || tag == Ul || tag == Table))) {
+            pop();
+        }
+        if (tag == Tr && m_depth > 0 && m_frames[m_depth - 1].tag == Tr) {
+            pop();
+        }
+    }
+
+    if (m_depth == MaxDepth) {
+        ++m_overflow;
+        return;
+    }
+
+    int section = -1;
+    if (tag == Div) {
+        const QByteArray id = attribute(attrs, size, "id");
+        for (int i = 0; !id.isEmpty() && i < SectionCount; ++i) {
+            if (id == sectionIds[i] && m_sectionRoot[i] == -1) {
+                section = i;
+                break;
+            }
+        }
+    }
+
+    push(tag, section);
+
+    // Match rules ending with this tag against path from section roots,
+    // daily sources don't pay for the hourly table
+    const int ruleCount = dailyRulesCount + (m_hourly ? hourlyRulesCount : 0);
+
+    quint8 tags[MaxDepth];
+    quint16 indexes[MaxDepth];
+    bool pathReady = false;
+
+    for (int i = 0; i < ruleCount; ++i) {
+        const PathRule &rule = i < dailyRulesCount ? dailyRules[i] : hourlyRules[i - dailyRulesCount];
+        const int root = m_sectionRoot[rule.section];
+        if (root == -1 || rule.steps[rule.stepCount - 1].tag != tag) {
+            continue;
+        }
+
+        if (!pathReady) {
+            for (int j = 0; j < m_depth; ++j) {
+                tags[j] = m_frames[j].tag;
+                indexes[j] = m_frames[j].index;
+            }
+            pathReady = true;
+        }
+
+        if (!matchSteps(rule.steps, rule.stepCount, tags + root + 1, indexes + root + 1, m_depth - root - 1)) {
+            continue;
+        }
+
+        if (rule.field == GismeteoParser::ForecastRecord || rule.field == GismeteoParser::HourlyRecord) {
+            GismeteoParser::setField(m_data, rule.field, QString());
+        } else if (rule.attribute) {
+            QString value = decode(attribute(attrs, size, rule.attribute));
+            if (rule.after) {
+                const int pos = value.indexOf(QLatin1String(rule.after));
+                value = pos == -1 ? QString() : value.mid(pos + qstrlen(rule.after));
+            }
+            if (rule.before) {
+                const int pos = value.indexOf(QLatin1String(rule.before));
+                value = pos == -1 ? QString() : value.left(pos);
+            }
+            GismeteoParser::setField(m_data, rule.field, value);
+        } else if (m_captureDepth == -1) {
+            m_captureField = rule.field;
+            m_captureDepth = m_depth - 1;
+        }
+    }
+}
+
+void GismeteoStreamParser::endElement(Tag tag)
+{
+    if (m_overflow > 0) {
+        --m_overflow;
+        return;
+    }
+
+    // Close up to the matching element, ignore stray end tags
+    for (int i = m_depth - 1; i >= 0; --i) {
+        if (m_frames[i].tag == tag) {
+            while (m_depth > i) {
+                pop();
+            }
+            return;
+        }
+    }
+}
+
+void GismeteoStreamParser::characters(const char *data, int size)
+{
+    if (m_captureDepth != -1) {
+        m_capture.append(data, size);
+    }
+}
+
+
+GismeteoSectionScanner::GismeteoSectionScanner()
+    : m_seenSections(0)
+{
+    for (int i = 0; i < GismeteoStreamParser::SectionCount; ++i) {
+        m_divDepth[i] = 0;
+    }
+}
+
+bool GismeteoSectionScanner::isComplete() const
+{
+    const quint8 required = GismeteoStreamParser::requiredSections();
+    return (m_seenSections & required) == required;
+}
+
+void GismeteoSectionScanner::startElement(Tag tag, const char *attrs, int size)
+{
+    if (tag != Div) {
+        return;
+    }
+
+    for (int i = 0; i < GismeteoStreamParser::SectionCount; ++i) {
+        if (m_divDepth[i] > 0) {
+            ++m_divDepth[i];
+        }
+    }
+
+    const QByteArray id = attribute(attrs, size, "id");
+    for (int i = 0; !id.isEmpty() && i < GismeteoStreamParser::SectionCount; ++i) {
+        if (id == sectionIds[i] && m_divDepth[i] == 0) {
+            m_divDepth[i] = 1;
+            break;
+        }
+    }
+}
+
+void GismeteoSectionScanner::endElement(Tag tag)
+{
+    if (tag != Div) {
+        return;
+    }
+
+    for (int i = 0; i < GismeteoStreamParser::SectionCount; ++i) {
+        if (m_divDepth[i] > 0 && --m_divDepth[i] == 0) {
+            m_seenSections |= 1 << i;
+        }
+    }
+}
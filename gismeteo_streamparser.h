@@ -0,0 +1,185 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* Incremental HTML tokenizer and streaming extractor for Gismeteo pages */
+
+#ifndef GISMETEO_STREAMPARSER_H
+#define GISMETEO_STREAMPARSER_H
+
+#include <QByteArray>
+
+#include "gismeteo_data.h"
+#include "gismeteo_parser.h"
+
+// Splits HTML into start tags, end tags and text as data arrives. Nothing
+// but an unfinished tag of limited size is kept between chunks. Script and style contents
+// are skipped, void and self-closing elements get their end tag right away.
+class GismeteoHtmlTokenizer
+{
+
+public:
+    // Tags the extractors care about, everything else is OtherTag
+    enum Tag {
+        OtherTag,
+        A, Area, Base, Body, Br, Col, Dd, Div, Dl, Dt, Embed, H6, Head, Hr,
+        Html, Img, Input, Li, Link, Meta, P, Param, Script, Source, Span,
+        Style, Table, Tbody, Td, Th, Thead, Tr, Ul, Wbr,
+        TagCount
+    };
+
+    GismeteoHtmlTokenizer();
+    virtual ~GismeteoHtmlTokenizer();
+
+    void feed(const QByteArray &data);
+    void feed(const char *data, int size);
+
+    // End of document, drops unfinished tag if any
+    void finish();
+
+    static Tag tag(const char *name, int size);
+    static bool isVoid(Tag tag);
+
+    // Value of attribute in raw attribute string of a start tag
+    static QByteArray attribute(const char *attrs, int size, const char *name);
+
+    // Decodes UTF-8 text with character references
+    static QString decode(const QByteArray &text);
+
+protected:
+    virtual void startElement(Tag tag, const char *attrs, int size) = 0;
+    virtual void endElement(Tag tag) = 0;
+    virtual void characters(const char *data, int size) = 0;
+
+private:
+    enum {
+        // Unfinished tag kept between chunks is cut off at this size
+        MaxTagSize = 8192
+    };
+
+    // Returns number of bytes consumed, stops at unfinished construct
+    int process(const char *data, int size);
+
+    void skipLongTag();
+    const char *findTerminator(const char *begin, const char *end) const;
+
+    QByteArray m_pending;
+
+    // Comment, script or style is skipped up to this string
+    const char *m_skipUntil;
+    bool m_skipConsume;
+
+};
+
+// Fills WeatherData straight from the token stream. Only the path of open
+// elements is kept; rules describing the values are matched against it
+// relative to the page sections holding them.
+class GismeteoStreamParser : public GismeteoHtmlTokenizer
+{
+
+public:
+    // Page sections with values
+    enum Section {
+        WeatherSection,
+        WaterSection,
+        AstronomySection,
+        WeatherDailySection,
+        SectionCount
+    };
+
+    // Rows of hourly table are only matched if asked for
+    explicit GismeteoStreamParser(bool hourly = false);
+
+    const WeatherData &weatherData() const;
+
+    // True if current weather section has been seen
+    bool isValid() const;
+
+    // True if all sections with values have been closed,
+    // rest of the page can be dropped
+    bool isComplete() const;
+
+    // Mask of sections holding values
+    static quint8 requiredSections();
+
+    // False if the query couldn't be turned into rules at build time,
+    // the page has to be parsed by XQuery then
+    static bool isSupported(bool hourly = false);
+
+protected:
+    void startElement(Tag tag, const char *attrs, int size);
+    void endElement(Tag tag);
+    void characters(const char *data, int size);
+
+private:
+    enum {
+        MaxDepth = 256
+    };
+
+    struct Frame {
+        quint8 tag;
+        qint8 section;          // section started by this element or -1
+        quint16 index;          // position among siblings with same tag
+        quint16 counts[TagCount];
+    };
+
+    void push(Tag tag, int section);
+    void pop();
+
+    Frame m_frames[MaxDepth];
+    int m_depth;
+    int m_overflow;
+    bool m_hourly;
+
+    // Depth of open section roots, -1 if not open
+    int m_sectionRoot[SectionCount];
+    quint8 m_seenSections;
+
+    // Value being collected from text of an element
+    GismeteoParser::Field m_captureField;
+    int m_captureDepth;
+    QByteArray m_capture;
+
+    WeatherData m_data;
+
+};
+
+// Tracks page sections without extracting anything, used to stop the
+// download early when the whole page is parsed afterwards.
+class GismeteoSectionScanner : public GismeteoHtmlTokenizer
+{
+
+public:
+    GismeteoSectionScanner();
+
+    // True if all sections with values have been closed
+    bool isComplete() const;
+
+protected:
+    void startElement(Tag tag, const char *attrs, int size);
+    void endElement(Tag tag);
+    void characters(const char *, int) {}
+
+private:
+    // Nesting of div elements in open sections, 0 if not open
+    int m_divDepth[GismeteoStreamParser::SectionCount];
+    quint8 m_seenSections;
+
+};
+
+#endif
@@ -0,0 +1,119 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* Tests of the incremental HTML tokenizer */
+
+#include <QElapsedTimer>
+
+#include <qtest_kde.h>
+
+#include "gismeteo_streamparser.h"
+
+// Counts start tags by kind and keeps attributes of the first div
+class CountingTokenizer : public GismeteoHtmlTokenizer
+{
+
+public:
+    CountingTokenizer() : divs(0), spans(0) {}
+
+    int divs;
+    int spans;
+    QByteArray divClass;
+
+protected:
+    void startElement(Tag tag, const char *attrs, int size)
+    {
+        if (tag == Div && !divs++) {
+            divClass = attribute(attrs, size, "class");
+        } else if (tag == Span) {
+            ++spans;
+        }
+    }
+    void endElement(Tag) {}
+    void characters(const char *, int) {}
+
+};
+
+static void feedInChunks(GismeteoHtmlTokenizer &tokenizer, const QByteArray &page, int chunkSize)
+{
+    for (int pos = 0; pos < page.size(); pos += chunkSize) {
+        tokenizer.feed(page.mid(pos, chunkSize));
+    }
+    tokenizer.finish();
+}
+
+class GismeteoStreamParserTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void quotedGreaterThan();
+    void unbalancedQuote();
+    void unfinishedTag();
+};
+
+// '>' inside a quoted value doesn't end the tag, even across chunks
+void GismeteoStreamParserTest::quotedGreaterThan()
+{
+    CountingTokenizer tokenizer;
+    feedInChunks(tokenizer, "<div class=\"a>b\"><span>x</span></div>", 3);
+
+    QCOMPARE(tokenizer.divs, 1);
+    QCOMPARE(tokenizer.divClass, QByteArray("a>b"));
+    QCOMPARE(tokenizer.spans, 1);
+}
+
+// Quote left open must not swallow the rest of a large page
+void GismeteoStreamParserTest::unbalancedQuote()
+{
+    const int rows = 50000;
+    QByteArray page = "<div class=\"a>";
+    for (int i = 0; i < rows; ++i) {
+        page += "<span>text</span>";
+    }
+
+    CountingTokenizer tokenizer;
+    QElapsedTimer timer;
+    timer.start();
+    feedInChunks(tokenizer, page, 1024);
+
+    QCOMPARE(tokenizer.divs, 1);
+    QCOMPARE(tokenizer.spans, rows);
+
+    // Rescanning the pending tag on every chunk would be quadratic
+    QVERIFY(timer.elapsed() < 5000);
+}
+
+// Tag without '>' for a long time is dropped, parsing goes on after it
+void GismeteoStreamParserTest::unfinishedTag()
+{
+    QByteArray page = "<div class=\"a";
+    page += QByteArray(1024 * 1024, 'x');
+    page += "\"><span>x</span>";
+
+    CountingTokenizer tokenizer;
+    feedInChunks(tokenizer, page, 1024);
+
+    QCOMPARE(tokenizer.divs, 0);
+    QCOMPARE(tokenizer.spans, 1);
+}
+
+QTEST_KDEMAIN_CORE(GismeteoStreamParserTest)
+
+#include "gismeteo_streamparsertest.moc"
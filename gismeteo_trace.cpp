@@ -0,0 +1,51 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* Tracing for Gismeteo ion */
+
+#include "gismeteo_trace.h"
+
+#include <QStringList>
+
+static int parseCategories(const QString &categories)
+{
+    int mask = 0;
+    foreach (const QString &category, categories.toLower().split(',', QString::SkipEmptyParts)) {
+        const QString name = category.trimmed();
+        if (name == "all") {
+            mask |= GismeteoTrace::Parser | GismeteoTrace::Network | GismeteoTrace::Publish;
+        } else if (name == "parser") {
+            mask |= GismeteoTrace::Parser;
+        } else if (name == "network") {
+            mask |= GismeteoTrace::Network;
+        } else if (name == "publish") {
+            mask |= GismeteoTrace::Publish;
+        } else if (name == "payload") {
+            mask |= GismeteoTrace::Payload;
+        }
+    }
+    return mask;
+}
+
+int GismeteoTrace::s_categories = parseCategories(QString::fromLocal8Bit(qgetenv("GISMETEO_TRACE")));
+
+void GismeteoTrace::setCategories(const QString &categories)
+{
+    s_categories = parseCategories(categories);
+}
@@ -0,0 +1,65 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* Tracing for Gismeteo ion */
+
+#ifndef GISMETEO_TRACE_H
+#define GISMETEO_TRACE_H
+
+#include <QString>
+
+#include <KDebug>
+
+// Categorized debug output for hot paths. Without GISMETEO_TRACE defined
+// at build time trace statements are dead code and their arguments are
+// never evaluated. With it, each statement costs a bit test until its
+// category is enabled by GISMETEO_TRACE environment variable or by
+// TraceCategories config key, like "parser,network" or "all".
+class GismeteoTrace
+{
+
+public:
+    enum Category {
+        Parser = 1 << 0,        // values extracted from pages
+        Network = 1 << 1,       // requests and their outcome
+        Publish = 1 << 2,       // data handed to the engine
+        Payload = 1 << 3        // whole pages and data maps, not part of "all"
+    };
+
+    static bool isEnabled(Category category)
+    {
+        return s_categories & category;
+    }
+
+    static void setCategories(const QString &categories);
+
+private:
+    static int s_categories;
+
+};
+
+#ifdef GISMETEO_TRACE
+#define gismeteoTrace(category) \
+    if (!GismeteoTrace::isEnabled(GismeteoTrace::category)) {} else kDebug()
+#else
+#define gismeteoTrace(category) \
+    if (true) {} else kDebug()
+#endif
+
+#endif
@@ -0,0 +1,578 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Alexey Torkhov <atorkhov@gmail.com>             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA          *
+ ***************************************************************************/
+
+/* Translates Gismeteo queries into rule tables for the stream parser */
+
+// Usage: gismeteo-xq2cpp <output> <table>=<query.xq>...
+//
+// Runs at build time, so it only needs the C++ library. Supported are
+// the constructs the weather queries use: for clauses over paths rooted
+// at a page section, element constructors, child and descendant steps
+// with positional predicates, attributes, data(), substring-after() and
+// substring-before(). If a query has anything else the table is marked
+// incomplete and the ion runs the query with QtXmlPatterns instead.
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Page sections of GismeteoStreamParser by id of their div
+const struct {
+    const char *id;
+    const char *section;
+} sectionTable[] = {
+    { "weather",       "WeatherSection" },
+    { "water",         "WaterSection" },
+    { "astronomy",     "AstronomySection" },
+    { "weather-daily", "WeatherDailySection" }
+};
+
+// Tags of GismeteoHtmlTokenizer, must be kept in sync with its Tag enum
+const struct {
+    const char *name;
+    const char *tag;
+} tagTable[] = {
+    { "a", "A" }, { "area", "Area" }, { "base", "Base" }, { "body", "Body" },
+    { "br", "Br" }, { "col", "Col" }, { "dd", "Dd" }, { "div", "Div" },
+    { "dl", "Dl" }, { "dt", "Dt" }, { "embed", "Embed" }, { "h6", "H6" },
+    { "head", "Head" }, { "hr", "Hr" }, { "html", "Html" }, { "img", "Img" },
+    { "input", "Input" }, { "li", "Li" }, { "link", "Link" }, { "meta", "Meta" },
+    { "p", "P" }, { "param", "Param" }, { "script", "Script" }, { "source", "Source" },
+    { "span", "Span" }, { "style", "Style" }, { "table", "Table" }, { "tbody", "Tbody" },
+    { "td", "Td" }, { "th", "Th" }, { "thead", "Thead" }, { "tr", "Tr" },
+    { "ul", "Ul" }, { "wbr", "Wbr" }
+};
+
+// GismeteoParser fields by element of query result, same as the
+// receiver of XQuery results reads them. Element 0 is the record itself,
+// field 0 means it has no value. Elements not listed are ignored.
+const struct {
+    const char *record;
+    const char *element;
+    const char *field;
+} fieldTable[] = {
+    { "current",  0,                    0 },
+    { "current",  "date",               "Date" },
+    { "current",  "condition",          "Condition" },
+    { "current",  "conditionIcon",      "ConditionIcon" },
+    { "current",  "temperature",        "Temperature" },
+    { "current",  "pressure",           "Pressure" },
+    { "current",  "windDirection",      "WindDirection" },
+    { "current",  "windSpeed",          "WindSpeed" },
+    { "current",  "humidity",           "Humidity" },
+    { "current",  "waterTemperature",   "WaterTemperature" },
+    { "forecast", 0,                    "ForecastRecord" },
+    { "forecast", "day",                "ForecastDay" },
+    { "forecast", "icon",               "ForecastIcon" },
+    { "forecast", "temperature",        "ForecastTemperature" },
+    { "hour",     0,                    "HourlyRecord" },
+    { "hour",     "date",               "HourlyDate" },
+    { "hour",     "condition",          "HourlyCondition" },
+    { "hour",     "temperature",        "HourlyTemperature" },
+    { "hour",     "pressure",           "HourlyPressure" },
+    { "hour",     "windDirection",      "HourlyWindDirection" },
+    { "hour",     "windSpeed",          "HourlyWindSpeed" },
+    { "hour",     "humidity",           "HourlyHumidity" },
+    { "hour",     "comfortTemperature", "HourlyComfortTemperature" }
+};
+
+// Steps a PathRule of the stream parser can hold
+const size_t maxSteps = 8;
+
+template <typename T, size_t N>
+size_t tableSize(const T (&)[N])
+{
+    return N;
+}
+
+struct Step {
+    std::string tag;
+    int position;               // 0 for any
+    bool descendant;
+};
+
+struct Path {
+    std::string section;        // section enumerator, empty if not rooted
+    std::string root;           // id of section div
+    std::vector<Step> steps;
+    std::string attribute;
+};
+
+// Value of a result element
+struct Value {
+    Path path;
+    std::string after;
+    std::string before;
+};
+
+class QueryReader
+{
+
+public:
+    explicit QueryReader(const std::string &text)
+        : m_text(text), m_pos(0)
+    {
+    }
+
+    // Reads the whole query, false if it has unsupported constructs
+    bool read()
+    {
+        if (!readSequence() || (skipSpace(), m_pos != m_text.size())) {
+            return fail("unexpected text");
+        }
+        return true;
+    }
+
+    const std::string &error() const
+    {
+        return m_error;
+    }
+
+    // Table entries, one string per rule
+    const std::vector<std::string> &rules() const
+    {
+        return m_rules;
+    }
+
+private:
+    bool fail(const std::string &what)
+    {
+        if (m_error.empty()) {
+            std::ostringstream message;
+            message << what << " at offset " << m_pos;
+            m_error = message.str();
+        }
+        return false;
+    }
+
+    // Skips white space and (: comments :)
+    void skipSpace()
+    {
+        for (;;) {
+            while (m_pos < m_text.size() && isspace(static_cast<unsigned char>(m_text[m_pos]))) {
+                ++m_pos;
+            }
+            if (m_text.compare(m_pos, 2, "(:") != 0) {
+                return;
+            }
+            const size_t end = m_text.find(":)", m_pos + 2);
+            m_pos = end == std::string::npos ? m_text.size() : end + 2;
+        }
+    }
+
+    bool peek(const char *token)
+    {
+        skipSpace();
+        return m_text.compare(m_pos, strlen(token), token) == 0;
+    }
+
+    bool accept(const char *token)
+    {
+        if (!peek(token)) {
+            return false;
+        }
+        m_pos += strlen(token);
+        return true;
+    }
+
+    bool expect(const char *token)
+    {
+        return accept(token) || fail(std::string("expected ") + token);
+    }
+
+    std::string name()
+    {
+        skipSpace();
+        const size_t start = m_pos;
+        while (m_pos < m_text.size() &&
+               (isalnum(static_cast<unsigned char>(m_text[m_pos])) || m_text[m_pos] == '_' ||
+                (m_pos > start && m_text[m_pos] == '-'))) {
+            ++m_pos;
+        }
+        return m_text.substr(start, m_pos - start);
+    }
+
+    bool string(std::string &value)
+    {
+        skipSpace();
+        if (m_pos >= m_text.size() || (m_text[m_pos] != '\'' && m_text[m_pos] != '"')) {
+            return fail("expected string literal");
+        }
+        const char quote = m_text[m_pos];
+        const size_t end = m_text.find(quote, m_pos + 1);
+        if (end == std::string::npos) {
+            return fail("unterminated string literal");
+        }
+        value = m_text.substr(m_pos + 1, end - m_pos - 1);
+        m_pos = end + 1;
+        return true;
+    }
+
+    // item (, item)*
+    bool readSequence()
+    {
+        do {
+            if (!readItem()) {
+                return false;
+            }
+        } while (accept(","));
+        return true;
+    }
+
+    bool readItem()
+    {
+        if (accept("<!--")) {
+            const size_t end = m_text.find("-->", m_pos);
+            if (end == std::string::npos) {
+                return fail("unterminated comment");
+            }
+            m_pos = end + 3;
+            return true;
+        }
+
+        if (peek("for") && (m_pos + 3 < m_text.size()) && isspace(static_cast<unsigned char>(m_text[m_pos + 3]))) {
+            m_pos += 3;
+            return readFor();
+        }
+
+        // Element wrapping a sequence, like <hourly> { ... } </hourly>
+        if (accept("<")) {
+            const std::string element = name();
+            if (element.empty() || !expect(">") || !expect("{") || !readSequence() || !expect("}") ||
+                !expect("</") || name() != element || !expect(">")) {
+                return fail("unsupported element constructor");
+            }
+            return true;
+        }
+
+        return fail("unsupported expression");
+    }
+
+    // for $var in path return <record> <element> { value } </element>... </record>
+    bool readFor()
+    {
+        if (!expect("$")) {
+            return false;
+        }
+        const std::string variable = name();
+
+        Path path;
+        if (!expect("in") || !readPath(path) || !expect("return") || !expect("<")) {
+            return false;
+        }
+        if (path.section.empty() || !path.attribute.empty()) {
+            return fail("for clause must select elements of a section");
+        }
+        m_variables[variable] = path;
+
+        const std::string record = name();
+        if (!expect(">")) {
+            return false;
+        }
+
+        const char *recordField = 0;
+        if (lookupField(record, 0, recordField) && recordField) {
+            addRule(path, Value(), recordField);
+        }
+
+        while (!accept("</")) {
+            if (!expect("<")) {
+                return false;
+            }
+            const std::string element = name();
+            Value value;
+            if (!expect(">") || !expect("{") || !readValue(value) || !expect("}") ||
+                !expect("</") || name() != element || !expect(">")) {
+                return false;
+            }
+
+            const char *field = 0;
+            if (lookupField(record, element.c_str(), field) && field && !addRule(value.path, value, field)) {
+                return false;
+            }
+        }
+
+        return (name() == record && expect(">")) || fail("mismatched end tag");
+    }
+
+    // data(path), substring-after(value, 'x'), substring-before(value, 'x')
+    bool readValue(Value &value)
+    {
+        const std::string function = name();
+        if (!expect("(")) {
+            return false;
+        }
+
+        if (function == "data") {
+            return readPath(value.path) && expect(")");
+        }
+
+        std::string argument;
+        if (function == "substring-after") {
+            if (!readValue(value) || !expect(",") || !string(argument) || !expect(")")) {
+                return false;
+            }
+            // The stream parser cuts the prefix first
+            if (!value.after.empty() || !value.before.empty()) {
+                return fail("unsupported nesting of substring functions");
+            }
+            value.after = argument;
+            return true;
+        }
+
+        if (function == "substring-before") {
+            if (!readValue(value) || !expect(",") || !string(argument) || !expect(")")) {
+                return false;
+            }
+            if (!value.before.empty()) {
+                return fail("unsupported nesting of substring functions");
+            }
+            value.before = argument;
+            return true;
+        }
+
+        return fail("unsupported function " + function);
+    }
+
+    // $var/step..., //div[@id='section']/step..., ending with /@attribute
+    bool readPath(Path &path)
+    {
+        if (accept("$")) {
+            const std::string variable = name();
+            std::map<std::string, Path>::const_iterator it = m_variables.find(variable);
+            if (it == m_variables.end()) {
+                return fail("unknown variable $" + variable);
+            }
+            path = it->second;
+        } else if (accept("//")) {
+            std::string id;
+            if (name() != "div" || !expect("[") || !expect("@") || name() != "id" || !expect("=") ||
+                !string(id) || !expect("]")) {
+                return fail("path must start at a section div");
+            }
+            for (size_t i = 0; i < tableSize(sectionTable); ++i) {
+                if (id == sectionTable[i].id) {
+                    path.section = sectionTable[i].section;
+                    path.root = id;
+                }
+            }
+            if (path.section.empty()) {
+                return fail("unknown section " + id);
+            }
+        } else {
+            return fail("unsupported path");
+        }
+
+        for (;;) {
+            Step step;
+            if (accept("//")) {
+                step.descendant = true;
+            } else if (accept("/")) {
+                step.descendant = false;
+            } else {
+                return true;
+            }
+
+            if (accept("@")) {
+                path.attribute = name();
+                return !path.attribute.empty() || fail("expected attribute name");
+            }
+
+            const std::string tag = name();
+            step.tag.clear();
+            for (size_t i = 0; i < tableSize(tagTable); ++i) {
+                if (tag == tagTable[i].name) {
+                    step.tag = tagTable[i].tag;
+                }
+            }
+            if (step.tag.empty()) {
+                return fail("unknown tag " + tag);
+            }
+
+            step.position = 0;
+            if (accept("[")) {
+                skipSpace();
+                const size_t start = m_pos;
+                while (m_pos < m_text.size() && isdigit(static_cast<unsigned char>(m_text[m_pos]))) {
+                    ++m_pos;
+                }
+                step.position = atoi(m_text.substr(start, m_pos - start).c_str());
+                if (step.position <= 0 || step.position > 255 || !expect("]")) {
+                    return fail("only positional predicates are supported");
+                }
+            }
+            path.steps.push_back(step);
+        }
+    }
+
+    static bool lookupField(const std::string &record, const char *element, const char *&field)
+    {
+        for (size_t i = 0; i < tableSize(fieldTable); ++i) {
+            if (record == fieldTable[i].record &&
+                (element ? fieldTable[i].element && strcmp(element, fieldTable[i].element) == 0
+                         : !fieldTable[i].element)) {
+                field = fieldTable[i].field;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool addRule(const Path &path, const Value &value, const char *field)
+    {
+        if (path.steps.empty() || path.steps.size() > maxSteps) {
+            return fail("path length is not supported");
+        }
+
+        std::ostringstream rule;
+        rule << "    // //div[@id='" << path.root << "']";
+        for (size_t i = 0; i < path.steps.size(); ++i) {
+            const Step &step = path.steps[i];
+            rule << (step.descendant ? "//" : "/") << lowerCase(step.tag);
+            if (step.position) {
+                rule << '[' << step.position << ']';
+            }
+        }
+        if (!path.attribute.empty()) {
+            rule << "/@" << path.attribute;
+        }
+
+        rule << "\n    { GismeteoStreamParser::" << path.section << ", " << path.steps.size() << ", { ";
+        for (size_t i = 0; i < path.steps.size(); ++i) {
+            const Step &step = path.steps[i];
+            if (i > 0) {
+                rule << ", ";
+            }
+            if (step.descendant) {
+                rule << "STEP_ANY(" << step.tag << ')';
+            } else if (step.position) {
+                rule << "STEP_AT(" << step.tag << ", " << step.position << ')';
+            } else {
+                rule << "STEP(" << step.tag << ')';
+            }
+        }
+        rule << " },\n      " << literal(path.attribute) << ", " << literal(value.after) << ", "
+             << literal(value.before) << ", GismeteoParser::" << field << " }";
+
+        m_rules.push_back(rule.str());
+        return true;
+    }
+
+    static std::string lowerCase(std::string text)
+    {
+        for (size_t i = 0; i < text.size(); ++i) {
+            text[i] = tolower(static_cast<unsigned char>(text[i]));
+        }
+        return text;
+    }
+
+    // C string literal, 0 for empty string
+    static std::string literal(const std::string &text)
+    {
+        if (text.empty()) {
+            return "0";
+        }
+
+        std::string result = "\"";
+        for (size_t i = 0; i < text.size(); ++i) {
+            if (text[i] == '"' || text[i] == '\\') {
+                result += '\\';
+            }
+            result += text[i];
+        }
+        return result + '"';
+    }
+
+    std::string m_text;
+    size_t m_pos;
+    std::string m_error;
+    std::map<std::string, Path> m_variables;
+    std::vector<std::string> m_rules;
+
+};
+
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <output> <table>=<query.xq>...\n", argv[0]);
+        return 1;
+    }
+
+    std::ostringstream output;
+    output << "/* Generated by gismeteo-xq2cpp, do not edit */\n";
+
+    for (int i = 2; i < argc; ++i) {
+        const std::string argument = argv[i];
+        const size_t equals = argument.find('=');
+        if (equals == std::string::npos) {
+            fprintf(stderr, "Expected <table>=<query.xq>, got %s\n", argv[i]);
+            return 1;
+        }
+        const std::string table = argument.substr(0, equals);
+        const std::string file = argument.substr(equals + 1);
+
+        std::ifstream input(file.c_str());
+        if (!input) {
+            fprintf(stderr, "Can't read %s\n", file.c_str());
+            return 1;
+        }
+        std::ostringstream text;
+        text << input.rdbuf();
+
+        QueryReader reader(text.str());
+        const bool complete = reader.read();
+        if (!complete) {
+            fprintf(stderr, "%s: %s, it will be run by XQuery engine\n", file.c_str(), reader.error().c_str());
+        }
+
+        // Incomplete table is kept empty, nothing is matched partially
+        const std::vector<std::string> &rules = reader.rules();
+        const size_t count = complete ? rules.size() : 0;
+
+        output << "\n// " << file.substr(file.find_last_of('/') + 1) << "\n";
+        output << "const PathRule " << table << "[] = {\n";
+        for (size_t j = 0; j < count; ++j) {
+            output << rules[j] << (j + 1 < count ? ",\n" : "\n");
+        }
+        if (count == 0) {
+            output << "    { GismeteoStreamParser::WeatherSection, 0, { }, 0, 0, 0, GismeteoParser::NoField }\n";
+        }
+        output << "};\n\n";
+        output << "const int " << table << "Count = " << count << ";\n";
+        output << "const bool " << table << "Complete = " << (complete ? "true" : "false") << ";\n";
+    }
+
+    std::ofstream file(argv[1]);
+    file << output.str();
+    if (!file) {
+        fprintf(stderr, "Can't write %s\n", argv[1]);
+        return 1;
+    }
+    return 0;
+}
@@ -23,522 +23,296 @@
 /* Ion for Gismeteo data */
 
 #include "ion_gismeteo.h"
-
-#include <QXmlQuery>
-#include <QXmlResultItems>
-#include <QXmlFormatter>
-#include <QFile>
-#include <QBuffer>
-#include <QStack>
+#include "gismeteo_parsepool.h"
+#include "gismeteo_scheduler.h"
+#include "gismeteo_streamparser.h"
+#include "gismeteo_trace.h"
 
 #include <KIO/Job>
+#include <KConfigGroup>
+#include <KDirWatch>
+#include <KSharedConfig>
 #include <KStandardDirs>
 #include <KUnitConversion/Converter>
-#include <Solid/Networking>
 #include <Plasma/DataContainer>
 
-#include <qlibxmlnodemodel.h>
+#include <algorithm>
 
-// Receiver for html weather data
-class Receiver : public QAbstractXmlReceiver
+// Ask for HTTP response headers and make request conditional
+static void setupConditionalRequest(KIO::Job *job, const EnvGismeteoIon::HttpValidators &validators)
 {
-public:
-    Receiver(const QXmlNamePool &namePool, WeatherData &weatherData);
-    void atomicValue(const QVariant &);
-    void endElement();
-    void startElement(const QXmlName &name);
-
-    void attribute(const QXmlName &, const QStringRef &) {};
-    void characters(const QStringRef &) {}
-    void comment(const QString &) {}
-    void endDocument() {}
-    void endOfSequence() {}
-    void namespaceBinding(const QXmlName &) {}
-    void processingInstruction(const QXmlName &, const QString &) {}
-    void startDocument() {}
-    void startOfSequence() {}
-
-    WeatherData &m_weatherData;
+    job->addMetaData("PropagateHttpHeader", "true");
 
-private:
-    QXmlNamePool m_namePool;
-    QStack<QString> m_elements;
-};
+    // HTTP errors fail the job instead of delivering error page as data
+    job->addMetaData("errorPage", "false");
 
-Receiver::Receiver(const QXmlNamePool &namePool, WeatherData &weatherData)
-    : m_weatherData(weatherData), m_namePool(namePool)
-{
-}
-
-// Called for every element
-void Receiver::startElement(const QXmlName &xmlname)
-{
-    QString name = xmlname.localName(m_namePool);
-    m_elements.push(name);
-
-    if (name == "forecast") {
-        m_weatherData.forecasts.append(WeatherData::Forecast());
+    QStringList headers;
+    if (!validators.etag.isEmpty()) {
+        headers << "If-None-Match: " + validators.etag;
+    }
+    if (!validators.lastModified.isEmpty()) {
+        headers << "If-Modified-Since: " + validators.lastModified;
+    }
+    if (!headers.isEmpty()) {
+        job->addMetaData("customHTTPHeader", headers.join("\r\n"));
     }
 }
 
-void Receiver::endElement()
-{
-    m_elements.pop();
-}
-
-// Called for every text node
-void Receiver::atomicValue(const QVariant &val)
+// Validators sent by server along with the page
+static EnvGismeteoIon::HttpValidators responseValidators(KIO::Job *job)
 {
-    QString value = val.toString();
-    QString currentElement = m_elements.top();
+    EnvGismeteoIon::HttpValidators validators;
 
-    kDebug() << currentElement << value;
-
-    if (m_weatherData.forecasts.empty()) {
-        if (currentElement == "date") {
-            m_weatherData.date = value;
-        } else if (currentElement == "condition") {
-            m_weatherData.condition = value;
-        } else if (currentElement == "conditionIcon") {
-            m_weatherData.conditionIcon = value;
-        } else if (currentElement == "temperature") {
-            if (value.endsWith(QString::fromUtf8("°C"))) {
-                value.chop(2);
-            }
-            m_weatherData.temperature = value;
-        } else if (currentElement == "pressure") {
-            if (value.endsWith(QString::fromUtf8("мм рт.ст."))) {
-                value.chop(9);
-            }
-            m_weatherData.pressure = value;
-        } else if (currentElement == "windDirection") {
-            m_weatherData.windDirection = value;
-        } else if (currentElement == "windSpeed") {
-            if (value.endsWith(QString::fromUtf8("м/с"))) {
-                value.chop(3);
-            }
-            m_weatherData.windSpeed = value;
-        } else if (currentElement == "humidity") {
-            if (value.endsWith(QString::fromUtf8("%"))) {
-                value.chop(1);
-            }
-            m_weatherData.humidity = value;
-        } else if (currentElement == "waterTemperature") {
-            if (value.endsWith(QString::fromUtf8("°C"))) {
-                value.chop(2);
-            }
-            m_weatherData.waterTemperature = value;
+    foreach (const QString &header, job->queryMetaData("HTTP-Headers").split('\n')) {
+        const int colon = header.indexOf(':');
+        if (colon == -1) {
+            continue;
         }
-    } else {
-        WeatherData::Forecast &currentForecast = m_weatherData.forecasts.back();
-
-        if (currentElement == "day") {
-            currentForecast.day = value;
-        } else if (currentElement == "icon") {
-            currentForecast.icon = value;
-        } else if (currentElement == "temperature") {
-            QStringList temp = value.split("..");
-            if (temp.size() == 2) {
-                currentForecast.temperatureLow = temp.at(0);
-                if (temp[0].endsWith(QString::fromUtf8("°"))) {
-                    currentForecast.temperatureLow.chop(1);
-                }
-                currentForecast.temperatureHigh = temp.at(1);
-                if (temp[1].endsWith(QString::fromUtf8("°"))) {
-                    currentForecast.temperatureHigh.chop(1);
-                }
-            }
+        const QString name = header.left(colon).trimmed().toLower();
+        if (name == "etag") {
+            validators.etag = header.mid(colon + 1).trimmed();
+        } else if (name == "last-modified") {
+            validators.lastModified = header.mid(colon + 1).trimmed();
         }
     }
+
+    return validators;
 }
 
-// Receiver for html search data
-class SearchReceiver : public QAbstractXmlReceiver
+static bool isNotModified(KIO::Job *job)
 {
-public:
-    SearchReceiver(const QXmlNamePool &namePool, QList<EnvGismeteoIon::XMLMapInfo> &places);
-    void atomicValue(const QVariant &);
-    void endElement();
-    void startElement(const QXmlName &name);
+    return job->queryMetaData("responsecode") == "304";
+}
 
-    void attribute(const QXmlName &, const QStringRef &) {};
-    void characters(const QStringRef &) {}
-    void comment(const QString &) {}
-    void endDocument() {}
-    void endOfSequence() {}
-    void namespaceBinding(const QXmlName &) {}
-    void processingInstruction(const QXmlName &, const QString &) {}
-    void startDocument() {}
-    void startOfSequence() {}
+static bool isFailed(KIO::Job *job)
+{
+    return job->error() || job->queryMetaData("responsecode").toInt() >= 400;
+}
 
-    QList<EnvGismeteoIon::XMLMapInfo> &m_places;
+// Retry delay after failures grows from a minute to an hour
+static const qint64 minRetryDelay = 60 * 1000;
+static const qint64 maxRetryDelay = 60 * 60 * 1000;
 
-private:
-    QXmlNamePool m_namePool;
-    QStack<QString> m_elements;
+// Search results this long may have been truncated by the site
+static const int maxSearchResults = 10;
 
-    EnvGismeteoIon::XMLMapInfo m_currentPlace;
-};
+// Weather saved between sessions, tests point it elsewhere through environment
+static QString cacheDirectory()
+{
+    const QByteArray directory = qgetenv("GISMETEO_CACHE_DIR");
+    return directory.isEmpty() ? KStandardDirs::locateLocal("cache", "plasma-ion-gismeteo/") : QString::fromLocal8Bit(directory);
+}
 
-SearchReceiver::SearchReceiver(const QXmlNamePool &namePool, QList<EnvGismeteoIon::XMLMapInfo> &places)
-    : m_places(places), m_namePool(namePool)
+// ctor, dtor
+EnvGismeteoIon::EnvGismeteoIon(QObject *parent, const QVariantList &args)
+        : IonInterface(parent, args),
+          m_weatherData(200, 600),
+          m_places(50, 3600),
+          m_placeIndex(500),
+          m_diskCache(cacheDirectory()),
+          m_useStreamParser(true),
+          m_earlyTermination(true),
+          m_parsePool(new GismeteoParsePool(&m_queryCache, this)),
+          m_scheduler(new GismeteoFetchScheduler(this))
 {
+    connect(m_parsePool, SIGNAL(weatherParsed(QString,WeatherData,bool)),
+            this, SLOT(slotWeatherParsed(QString,WeatherData,bool)));
+    connect(m_parsePool, SIGNAL(searchParsed(QString,QList<XMLMapInfo>,bool)),
+            this, SLOT(slotSearchParsed(QString,QList<XMLMapInfo>,bool)));
+    connect(m_scheduler, SIGNAL(ready(QString,KUrl)), this, SLOT(slotFetchReady(QString,KUrl)));
+    connect(this, SIGNAL(sourceRemoved(QString)), this, SLOT(slotSourceRemoved(QString)));
+
+    // Downloads wait while there is no network
+    connect(Solid::Networking::notifier(), SIGNAL(statusChanged(Solid::Networking::Status)),
+            this, SLOT(slotNetworkStatusChanged(Solid::Networking::Status)));
+    slotNetworkStatusChanged(Solid::Networking::status());
 }
 
-// Called for every element
-void SearchReceiver::startElement(const QXmlName &xmlname)
+void EnvGismeteoIon::reset()
 {
-    QString name = xmlname.localName(m_namePool);
-    m_elements.push(name);
+    m_weatherData.clear();
+    m_places.clear();
+    m_placeIndex.clear();
+    m_backoff.clear();
+    m_hourlyCodes.clear();
 
-    if (name == "place") {
-        m_currentPlace = EnvGismeteoIon::XMLMapInfo();
-        m_currentPlace.id = 0;
-    }
+    emit resetCompleted(this, true);
 }
 
-void SearchReceiver::endElement()
+EnvGismeteoIon::~EnvGismeteoIon()
 {
-    QString currentElement = m_elements.top();
+    // Wait for workers before the query cache they use goes away
+    delete m_parsePool;
 
-    if (currentElement == "place") {
-        m_places.append(m_currentPlace);
+    foreach (const WeatherJob &weatherJob, m_jobs) {
+        delete weatherJob.parser;
+        delete weatherJob.scanner;
     }
-
-    m_elements.pop();
 }
 
-// Called for every text nodeurl
-void SearchReceiver::atomicValue(const QVariant &val)
+// Get the master list of locations to be parsed
+void EnvGismeteoIon::init()
 {
-    QString value = val.toString();
-    QString currentElement = m_elements.top();
+    gismeteoTrace(Network) << "init()";
 
-    kDebug() << currentElement << value;
+    const KConfigGroup config(KSharedConfig::openConfig("plasma-ion-gismeteorc"), "General");
 
-    if (currentElement == "name") {
-        m_currentPlace.name = value;
-    } else if (currentElement == "link") {
-        m_currentPlace.link = value;
+    // Trace categories, environment variable is the default
+    GismeteoTrace::setCategories(config.readEntry("TraceCategories", QString::fromLocal8Bit(qgetenv("GISMETEO_TRACE"))));
 
-        QRegExp rxlink("/city/daily/([0-9]+)/");
-        int pos = rxlink.indexIn(value);
-        if (pos > -1) {
-            m_currentPlace.id = rxlink.cap(1).toInt();
-        }
+    // Pages can be served by a local stand-in of the site for testing,
+    // environment variable is the default
+    const QByteArray baseUrl = qgetenv("GISMETEO_BASE_URL");
+    m_baseUrl = config.readEntry("BaseUrl", baseUrl.isEmpty() ? QString("http://www.gismeteo.ru/") : QString::fromLocal8Bit(baseUrl));
+    if (!m_baseUrl.endsWith('/')) {
+        m_baseUrl += '/';
     }
-}
 
+    // Parser backend: "stream" extracts values as data arrives with rules
+    // generated from the queries at build time, "xquery" runs the queries
+    // over the whole page and is kept for cross-checking
+    m_useStreamParser = config.readEntry("Parser", "stream") != "xquery";
 
-// ctor, dtor
-EnvGismeteoIon::EnvGismeteoIon(QObject *parent, const QVariantList &args)
-        : IonInterface(parent, args)
-{
+    // Pages parsed or waiting in worker threads of the XQuery backend at
+    // once, more wait in the ion. Default is twice the number of cores.
+    m_parsePool->setMaxInFlight(config.readEntry("MaxParsesInFlight", m_parsePool->maxInFlight()));
+
+    // Downloads running at once, spacing of requests to the site and
+    // random delay of weather refreshes, in milliseconds
+    m_scheduler->setMaxConcurrent(config.readEntry("MaxConcurrentFetches", 4));
+    m_scheduler->setHostInterval(config.readEntry("HostInterval", 100));
+    m_scheduler->setJitter(config.readEntry("FetchJitter", 2000));
+
+    // Stop downloading the page once all sections with values are over
+    m_earlyTermination = config.readEntry("EarlyTermination", true);
+
+    // Limits of in-memory caches, time to live is in seconds
+    m_weatherData.setMaxEntries(config.readEntry("WeatherCacheSize", 200));
+    m_weatherData.setTimeToLive(config.readEntry("WeatherCacheTimeToLive", 600));
+    m_places.setMaxEntries(config.readEntry("SearchCacheSize", 50));
+    m_places.setTimeToLive(config.readEntry("SearchCacheTimeToLive", 3600));
+    m_placeIndex.setMaxEntries(config.readEntry("PlaceIndexSize", 500));
+
+    connect(KDirWatch::self(), SIGNAL(dirty(QString)), this, SLOT(slotQueryFileChanged(QString)));
+    connect(KDirWatch::self(), SIGNAL(created(QString)), this, SLOT(slotQueryFileChanged(QString)));
+    connect(KDirWatch::self(), SIGNAL(deleted(QString)), this, SLOT(slotQueryFileChanged(QString)));
+
+    // Local and bundled city catalogues
+    m_catalogue.load(KGlobal::dirs()->findAllResources("data", "plasma-ion-gismeteo/gismeteo-cities.txt"));
+
+    // Compile queries upfront so the first fetch doesn't pay for it
+    m_queryCache.query(queryFile("gismeteo.xq"));
+    m_queryCache.query(queryFile("gismeteo-search.xq"));
+
+    setInitialized(true);
 }
 
-void EnvGismeteoIon::reset()
+QString EnvGismeteoIon::queryFile(const QString& name)
 {
+    QHash<QString, QString>::const_iterator it = m_queryFiles.constFind(name);
+    if (it != m_queryFiles.constEnd()) {
+        return it.value();
+    }
+
+    const QString path = KGlobal::dirs()->findResource("data", "plasma-ion-gismeteo/" + name);
+    if (path.isEmpty()) {
+        kDebug() << "Can't find XQuery file" << name;
+        return path;
+    }
+
+    KDirWatch::self()->addFile(path);
+    m_queryFiles.insert(name, path);
+    return path;
 }
 
-EnvGismeteoIon::~EnvGismeteoIon()
+void EnvGismeteoIon::slotQueryFileChanged(const QString &path)
 {
+    // Not our file
+    if (std::find(m_queryFiles.constBegin(), m_queryFiles.constEnd(), path) == m_queryFiles.constEnd()) {
+        return;
+    }
+
+    kDebug() << "XQuery file changed" << path;
+    m_queryCache.invalidate(path);
 }
 
-// Get the master list of locations to be parsed
-void EnvGismeteoIon::init()
+// Icon category by cloud level and precipitation intensity, mirrors
+// how Gismeteo draws the same components
+enum IconCategory {
+    ChanceCategory,
+    LightCategory,
+    HeavyCategory,
+    ShowerCategory
+};
+
+static const IconCategory iconCategories[5][4] = {
+    { ChanceCategory, ChanceCategory, ChanceCategory, ChanceCategory },
+    { ChanceCategory, ChanceCategory, ChanceCategory, ChanceCategory },
+    { ChanceCategory, ChanceCategory, HeavyCategory,  HeavyCategory  },
+    { ChanceCategory, LightCategory,  HeavyCategory,  HeavyCategory  },
+    { ShowerCategory, LightCategory,  HeavyCategory,  HeavyCategory  }
+};
+
+// [night][clouds]
+static const IonInterface::ConditionIcons cloudIcons[2][5] = {
+    { IonInterface::ClearDay, IonInterface::FewCloudsDay, IonInterface::FewCloudsDay,
+      IonInterface::PartlyCloudyDay, IonInterface::Overcast },
+    { IonInterface::ClearNight, IonInterface::FewCloudsNight, IonInterface::FewCloudsNight,
+      IonInterface::PartlyCloudyNight, IonInterface::Overcast }
+};
+
+// [night][category], thunderstorm takes precedence over rain and snow
+static const IonInterface::ConditionIcons rainIcons[2][4] = {
+    { IonInterface::ChanceShowersDay, IonInterface::LightRain, IonInterface::Rain, IonInterface::Showers },
+    { IonInterface::ChanceShowersNight, IonInterface::LightRain, IonInterface::Rain, IonInterface::Showers }
+};
+
+static const IonInterface::ConditionIcons snowIcons[2][4] = {
+    { IonInterface::ChanceSnowDay, IonInterface::LightSnow, IonInterface::Snow, IonInterface::Flurries },
+    { IonInterface::ChanceSnowNight, IonInterface::LightSnow, IonInterface::Snow, IonInterface::Flurries }
+};
+
+static const IonInterface::ConditionIcons thunderstormIcons[2][4] = {
+    { IonInterface::ChanceThunderstormDay, IonInterface::Thunderstorm, IonInterface::Thunderstorm, IonInterface::Thunderstorm },
+    { IonInterface::ChanceThunderstormNight, IonInterface::Thunderstorm, IonInterface::Thunderstorm, IonInterface::Thunderstorm }
+};
+
+static IonInterface::ConditionIcons conditionIcon(quint16 icon)
 {
-    kDebug() << "init()";
+    if (!icon) {
+        return IonInterface::NotAvailable;
+    }
 
-    setInitialized(true);
-}
+    const int night = WeatherIcon::isNight(icon) ? 1 : 0;
+    const int clouds = WeatherIcon::clouds(icon);
+    const WeatherIcon::Precipitation precipitation = WeatherIcon::precipitation(icon);
 
-QMap<QString, IonInterface::ConditionIcons> EnvGismeteoIon::setupConditionIconMappings(void) const
-{
-    QMap<QString, ConditionIcons> conditionList;
-
-    return conditionList;
-}
-
-QMap<QString, IonInterface::ConditionIcons> EnvGismeteoIon::setupForecastIconMappings(void) const
-{
-    QMap<QString, ConditionIcons> forecastList;
-
-    // Clouds
-    forecastList[QString::fromUtf8("d.sun.png")]            = ClearDay;
-    forecastList[QString::fromUtf8("d.sun.c1.png")]         = FewCloudsDay;
-    forecastList[QString::fromUtf8("d.sun.c2.png")]         = FewCloudsDay;
-    forecastList[QString::fromUtf8("d.sun.c3.png")]         = PartlyCloudyDay;
-    forecastList[QString::fromUtf8("d.sun.c4.png")]         = Overcast;
-
-    // Clouds + rain
-    forecastList[QString::fromUtf8("d.sun.r1.png")]         = ChanceShowersDay;
-    forecastList[QString::fromUtf8("d.sun.r2.png")]         = ChanceShowersDay;
-    forecastList[QString::fromUtf8("d.sun.r3.png")]         = ChanceShowersDay;
-    forecastList[QString::fromUtf8("d.sun.r4.png")]         = ChanceShowersDay;
-    forecastList[QString::fromUtf8("d.sun.c1.r1.png")]      = ChanceShowersDay;
-    forecastList[QString::fromUtf8("d.sun.c1.r2.png")]      = ChanceShowersDay;
-    forecastList[QString::fromUtf8("d.sun.c1.r3.png")]      = ChanceShowersDay;
-    forecastList[QString::fromUtf8("d.sun.c1.r4.png")]      = ChanceShowersDay;
-    forecastList[QString::fromUtf8("d.sun.c2.r1.png")]      = ChanceShowersDay;
-    forecastList[QString::fromUtf8("d.sun.c2.r2.png")]      = ChanceShowersDay;
-    forecastList[QString::fromUtf8("d.sun.c2.r3.png")]      = Rain;
-    forecastList[QString::fromUtf8("d.sun.c2.r4.png")]      = Rain;
-    forecastList[QString::fromUtf8("d.sun.c3.r1.png")]      = ChanceShowersDay;
-    forecastList[QString::fromUtf8("d.sun.c3.r2.png")]      = LightRain;
-    forecastList[QString::fromUtf8("d.sun.c3.r3.png")]      = Rain;
-    forecastList[QString::fromUtf8("d.sun.c3.r4.png")]      = Rain;
-    forecastList[QString::fromUtf8("d.sun.c4.r1.png")]      = Showers;
-    forecastList[QString::fromUtf8("d.sun.c4.r2.png")]      = LightRain;
-    forecastList[QString::fromUtf8("d.sun.c4.r3.png")]      = Rain;
-    forecastList[QString::fromUtf8("d.sun.c4.r4.png")]      = Rain;
-
-    // Clouds + thunderstorm
-    forecastList[QString::fromUtf8("d.sun.st.png")]         = ClearDay;
-    forecastList[QString::fromUtf8("d.sun.c1.st.png")]      = ClearDay;
-    forecastList[QString::fromUtf8("d.sun.c2.st.png")]      = FewCloudsDay;
-    forecastList[QString::fromUtf8("d.sun.c3.st.png")]      = PartlyCloudyDay;
-    forecastList[QString::fromUtf8("d.sun.c4.st.png")]      = Overcast;
-
-    // Clouds + rain + thunderstorm
-    forecastList[QString::fromUtf8("d.sun.r1.st.png")]      = ChanceThunderstormDay;
-    forecastList[QString::fromUtf8("d.sun.r2.st.png")]      = ChanceThunderstormDay;
-    forecastList[QString::fromUtf8("d.sun.r3.st.png")]      = ChanceThunderstormDay;
-    forecastList[QString::fromUtf8("d.sun.r4.st.png")]      = ChanceThunderstormDay;
-    forecastList[QString::fromUtf8("d.sun.c1.r1.st.png")]   = ChanceThunderstormDay;
-    forecastList[QString::fromUtf8("d.sun.c1.r2.st.png")]   = ChanceThunderstormDay;
-    forecastList[QString::fromUtf8("d.sun.c1.r3.st.png")]   = ChanceThunderstormDay;
-    forecastList[QString::fromUtf8("d.sun.c1.r4.st.png")]   = ChanceThunderstormDay;
-    forecastList[QString::fromUtf8("d.sun.c2.r1.st.png")]   = ChanceThunderstormDay;
-    forecastList[QString::fromUtf8("d.sun.c2.r2.st.png")]   = ChanceThunderstormDay;
-    forecastList[QString::fromUtf8("d.sun.c2.r3.st.png")]   = Thunderstorm;
-    forecastList[QString::fromUtf8("d.sun.c2.r4.st.png")]   = Thunderstorm;
-    forecastList[QString::fromUtf8("d.sun.c3.r1.st.png")]   = ChanceThunderstormDay;
-    forecastList[QString::fromUtf8("d.sun.c3.r2.st.png")]   = Thunderstorm;
-    forecastList[QString::fromUtf8("d.sun.c3.r3.st.png")]   = Thunderstorm;
-    forecastList[QString::fromUtf8("d.sun.c3.r4.st.png")]   = Thunderstorm;
-    forecastList[QString::fromUtf8("d.sun.c4.r1.st.png")]   = Thunderstorm;
-    forecastList[QString::fromUtf8("d.sun.c4.r2.st.png")]   = Thunderstorm;
-    forecastList[QString::fromUtf8("d.sun.c4.r3.st.png")]   = Thunderstorm;
-    forecastList[QString::fromUtf8("d.sun.c4.r4.st.png")]   = Thunderstorm;
-
-    // Clouds + snow
-    forecastList[QString::fromUtf8("d.sun.s1.png")]         = ChanceSnowDay;
-    forecastList[QString::fromUtf8("d.sun.s2.png")]         = ChanceSnowDay;
-    forecastList[QString::fromUtf8("d.sun.s3.png")]         = ChanceSnowDay;
-    forecastList[QString::fromUtf8("d.sun.s4.png")]         = ChanceSnowDay;
-    forecastList[QString::fromUtf8("d.sun.c1.s1.png")]      = ChanceSnowDay;
-    forecastList[QString::fromUtf8("d.sun.c1.s2.png")]      = ChanceSnowDay;
-    forecastList[QString::fromUtf8("d.sun.c1.s3.png")]      = ChanceSnowDay;
-    forecastList[QString::fromUtf8("d.sun.c1.s4.png")]      = ChanceSnowDay;
-    forecastList[QString::fromUtf8("d.sun.c2.s1.png")]      = ChanceSnowDay;
-    forecastList[QString::fromUtf8("d.sun.c2.s2.png")]      = ChanceSnowDay;
-    forecastList[QString::fromUtf8("d.sun.c2.s3.png")]      = Snow;
-    forecastList[QString::fromUtf8("d.sun.c2.s4.png")]      = Snow;
-    forecastList[QString::fromUtf8("d.sun.c3.s1.png")]      = ChanceSnowDay;
-    forecastList[QString::fromUtf8("d.sun.c3.s2.png")]      = LightSnow;
-    forecastList[QString::fromUtf8("d.sun.c3.s3.png")]      = Snow;
-    forecastList[QString::fromUtf8("d.sun.c3.s4.png")]      = Snow;
-    forecastList[QString::fromUtf8("d.sun.c4.s1.png")]      = Flurries;
-    forecastList[QString::fromUtf8("d.sun.c4.s2.png")]      = LightSnow;
-    forecastList[QString::fromUtf8("d.sun.c4.s3.png")]      = Snow;
-    forecastList[QString::fromUtf8("d.sun.c4.s4.png")]      = Snow;
-
-    // Clouds + snow + thunderstorm
-    forecastList[QString::fromUtf8("d.sun.s1.st.png")]      = ChanceThunderstormDay;
-    forecastList[QString::fromUtf8("d.sun.s2.st.png")]      = ChanceThunderstormDay;
-    forecastList[QString::fromUtf8("d.sun.s3.st.png")]      = ChanceThunderstormDay;
-    forecastList[QString::fromUtf8("d.sun.s4.st.png")]      = ChanceThunderstormDay;
-    forecastList[QString::fromUtf8("d.sun.c1.s1.st.png")]   = ChanceThunderstormDay;
-    forecastList[QString::fromUtf8("d.sun.c1.s2.st.png")]   = ChanceThunderstormDay;
-    forecastList[QString::fromUtf8("d.sun.c1.s3.st.png")]   = ChanceThunderstormDay;
-    forecastList[QString::fromUtf8("d.sun.c1.s4.st.png")]   = ChanceThunderstormDay;
-    forecastList[QString::fromUtf8("d.sun.c2.s1.st.png")]   = ChanceThunderstormDay;
-    forecastList[QString::fromUtf8("d.sun.c2.s2.st.png")]   = ChanceThunderstormDay;
-    forecastList[QString::fromUtf8("d.sun.c2.s3.st.png")]   = Thunderstorm;
-    forecastList[QString::fromUtf8("d.sun.c2.s4.st.png")]   = Thunderstorm;
-    forecastList[QString::fromUtf8("d.sun.c3.s1.st.png")]   = ChanceThunderstormDay;
-    forecastList[QString::fromUtf8("d.sun.c3.s2.st.png")]   = Thunderstorm;
-    forecastList[QString::fromUtf8("d.sun.c3.s3.st.png")]   = Thunderstorm;
-    forecastList[QString::fromUtf8("d.sun.c3.s4.st.png")]   = Thunderstorm;
-    forecastList[QString::fromUtf8("d.sun.c4.s1.st.png")]   = Thunderstorm;
-    forecastList[QString::fromUtf8("d.sun.c4.s2.st.png")]   = Thunderstorm;
-    forecastList[QString::fromUtf8("d.sun.c4.s3.st.png")]   = Thunderstorm;
-    forecastList[QString::fromUtf8("d.sun.c4.s4.st.png")]   = Thunderstorm;
- 
-    return forecastList;
-}
-
-QMap<QString, QString> EnvGismeteoIon::setupForecastConditionMappings(void) const
-{
-    QMap<QString, QString> forecastList;
-
-    // Clouds
-    forecastList[QString::fromUtf8("d.sun.png")]            = QString::fromUtf8("Ясно");
-    forecastList[QString::fromUtf8("d.sun.c1.png")]         = QString::fromUtf8("Малооблачно");
-    forecastList[QString::fromUtf8("d.sun.c2.png")]         = QString::fromUtf8("Малооблачно");
-    forecastList[QString::fromUtf8("d.sun.c3.png")]         = QString::fromUtf8("Облачно");
-    forecastList[QString::fromUtf8("d.sun.c4.png")]         = QString::fromUtf8("Пасмурно");
-
-    // Clouds + rain
-    forecastList[QString::fromUtf8("d.sun.r1.png")]         = QString::fromUtf8("Ясно, небольшой дождь");
-    forecastList[QString::fromUtf8("d.sun.r2.png")]         = QString::fromUtf8("Ясно, дождь");
-    forecastList[QString::fromUtf8("d.sun.r3.png")]         = QString::fromUtf8("Ясно, сильный дождь");
-    forecastList[QString::fromUtf8("d.sun.r4.png")]         = QString::fromUtf8("Ясно, ливень");
-    forecastList[QString::fromUtf8("d.sun.c1.r1.png")]      = QString::fromUtf8("Малооблачно, небольшой дождь");
-    forecastList[QString::fromUtf8("d.sun.c1.r2.png")]      = QString::fromUtf8("Малооблачно, дождь");
-    forecastList[QString::fromUtf8("d.sun.c1.r3.png")]      = QString::fromUtf8("Малооблачно, сильный дождь");
-    forecastList[QString::fromUtf8("d.sun.c1.r4.png")]      = QString::fromUtf8("Малооблачно, ливень");
-    forecastList[QString::fromUtf8("d.sun.c2.r1.png")]      = QString::fromUtf8("Малооблачно, небольшой дождь");
-    forecastList[QString::fromUtf8("d.sun.c2.r2.png")]      = QString::fromUtf8("Малооблачно, дождь");
-    forecastList[QString::fromUtf8("d.sun.c2.r3.png")]      = QString::fromUtf8("Малооблачно, ливень");
-    forecastList[QString::fromUtf8("d.sun.c2.r4.png")]      = QString::fromUtf8("Малооблачно, ливень");
-    forecastList[QString::fromUtf8("d.sun.c3.r1.png")]      = QString::fromUtf8("Облачно, небольшой дождь");
-    forecastList[QString::fromUtf8("d.sun.c3.r2.png")]      = QString::fromUtf8("Облачно, дождь");
-    forecastList[QString::fromUtf8("d.sun.c3.r3.png")]      = QString::fromUtf8("Облачно, сильный дождь");
-    forecastList[QString::fromUtf8("d.sun.c3.r4.png")]      = QString::fromUtf8("Облачно, ливень");
-    forecastList[QString::fromUtf8("d.sun.c4.r1.png")]      = QString::fromUtf8("Пасмурно, небольшой дождь");
-    forecastList[QString::fromUtf8("d.sun.c4.r2.png")]      = QString::fromUtf8("Пасмурно, дождь");
-    forecastList[QString::fromUtf8("d.sun.c4.r3.png")]      = QString::fromUtf8("Пасмурно, сильный дождь");
-    forecastList[QString::fromUtf8("d.sun.c4.r4.png")]      = QString::fromUtf8("Пасмурно, ливень");
-
-    // Clouds + thunderstorm
-    forecastList[QString::fromUtf8("d.sun.st.png")]         = QString::fromUtf8("Ясно, гроза");
-    forecastList[QString::fromUtf8("d.sun.c1.st.png")]      = QString::fromUtf8("Малооблачно, гроза");
-    forecastList[QString::fromUtf8("d.sun.c2.st.png")]      = QString::fromUtf8("Малооблачно, гроза");
-    forecastList[QString::fromUtf8("d.sun.c3.st.png")]      = QString::fromUtf8("Облачно, гроза");
-    forecastList[QString::fromUtf8("d.sun.c4.st.png")]      = QString::fromUtf8("Пасмурно, гроза");
-
-    // Clouds + rain + thunderstorm
-    forecastList[QString::fromUtf8("d.sun.c1.r1.st.png")]   = QString::fromUtf8("Малооблачно, небольшой дождь, гроза");
-    forecastList[QString::fromUtf8("d.sun.c1.r2.st.png")]   = QString::fromUtf8("Малооблачно, дождь, гроза");
-    forecastList[QString::fromUtf8("d.sun.c1.r3.st.png")]   = QString::fromUtf8("Малооблачно, сильный дождь, гроза");
-    forecastList[QString::fromUtf8("d.sun.c1.r4.st.png")]   = QString::fromUtf8("Малооблачно, ливень, гроза");
-    forecastList[QString::fromUtf8("d.sun.c2.r1.st.png")]   = QString::fromUtf8("Малооблачно, небольшой дождь, гроза");
-    forecastList[QString::fromUtf8("d.sun.c2.r2.st.png")]   = QString::fromUtf8("Малооблачно, дождь, гроза");
-    forecastList[QString::fromUtf8("d.sun.c2.r3.st.png")]   = QString::fromUtf8("Малооблачно, сильный дождь, гроза");
-    forecastList[QString::fromUtf8("d.sun.c2.r4.st.png")]   = QString::fromUtf8("Малооблачно, ливень, гроза");
-    forecastList[QString::fromUtf8("d.sun.c3.r1.st.png")]   = QString::fromUtf8("Облачно, небольшой дождь, гроза");
-    forecastList[QString::fromUtf8("d.sun.c3.r2.st.png")]   = QString::fromUtf8("Облачно, дождь, гроза");
-    forecastList[QString::fromUtf8("d.sun.c3.r3.st.png")]   = QString::fromUtf8("Облачно, сильный дождь, гроза");
-    forecastList[QString::fromUtf8("d.sun.c3.r4.st.png")]   = QString::fromUtf8("Облачно, ливень, гроза");
-    forecastList[QString::fromUtf8("d.sun.c4.r1.st.png")]   = QString::fromUtf8("Пасмурно, небольшой дождь, гроза");
-    forecastList[QString::fromUtf8("d.sun.c4.r2.st.png")]   = QString::fromUtf8("Пасмурно, дождь, гроза");
-    forecastList[QString::fromUtf8("d.sun.c4.r3.st.png")]   = QString::fromUtf8("Пасмурно, сильный дождь, гроза");
-    forecastList[QString::fromUtf8("d.sun.c3.r4.st.png")]   = QString::fromUtf8("Облачно, ливень, гроза");
-
-    // Clouds + snow
-    forecastList[QString::fromUtf8("d.sun.s1.png")]         = QString::fromUtf8("Ясно, небольшой снег");
-    forecastList[QString::fromUtf8("d.sun.s2.png")]         = QString::fromUtf8("Ясно, снег");
-    forecastList[QString::fromUtf8("d.sun.s3.png")]         = QString::fromUtf8("Ясно, сильный снег");
-    forecastList[QString::fromUtf8("d.sun.s4.png")]         = QString::fromUtf8("Ясно, буран");
-    forecastList[QString::fromUtf8("d.sun.c1.s1.png")]      = QString::fromUtf8("Малооблачно, небольшой снег");
-    forecastList[QString::fromUtf8("d.sun.c1.s2.png")]      = QString::fromUtf8("Малооблачно, снег");
-    forecastList[QString::fromUtf8("d.sun.c1.s3.png")]      = QString::fromUtf8("Малооблачно, сильный снег");
-    forecastList[QString::fromUtf8("d.sun.c1.s4.png")]      = QString::fromUtf8("Малооблачно, буран");
-    forecastList[QString::fromUtf8("d.sun.c2.s1.png")]      = QString::fromUtf8("Малооблачно, небольшой снег");
-    forecastList[QString::fromUtf8("d.sun.c2.s2.png")]      = QString::fromUtf8("Малооблачно, снег");
-    forecastList[QString::fromUtf8("d.sun.c2.s3.png")]      = QString::fromUtf8("Малооблачно, сильный снег");
-    forecastList[QString::fromUtf8("d.sun.c2.s4.png")]      = QString::fromUtf8("Малооблачно, буран");
-    forecastList[QString::fromUtf8("d.sun.c3.s1.png")]      = QString::fromUtf8("Облачно, небольшой снег");
-    forecastList[QString::fromUtf8("d.sun.c3.s2.png")]      = QString::fromUtf8("Облачно, снег");
-    forecastList[QString::fromUtf8("d.sun.c3.s3.png")]      = QString::fromUtf8("Облачно, сильный снег");
-    forecastList[QString::fromUtf8("d.sun.c3.s4.png")]      = QString::fromUtf8("Облачно, буран");
-    forecastList[QString::fromUtf8("d.sun.c4.s1.png")]      = QString::fromUtf8("Пасмурно, небольшой снег");
-    forecastList[QString::fromUtf8("d.sun.c4.s2.png")]      = QString::fromUtf8("Пасмурно, снег");
-    forecastList[QString::fromUtf8("d.sun.c4.s3.png")]      = QString::fromUtf8("Пасмурно, сильный снег");
-    forecastList[QString::fromUtf8("d.sun.c4.s4.png")]      = QString::fromUtf8("Пасмурно, буран");
-
-    // Clouds + snow + thunderstorm
-    forecastList[QString::fromUtf8("d.sun.s1.st.png")]      = QString::fromUtf8("Ясно, небольшой снег, гроза");
-    forecastList[QString::fromUtf8("d.sun.s2.st.png")]      = QString::fromUtf8("Ясно, снег, гроза");
-    forecastList[QString::fromUtf8("d.sun.s3.st.png")]      = QString::fromUtf8("Ясно, сильный снег, гроза");
-    forecastList[QString::fromUtf8("d.sun.s4.st.png")]      = QString::fromUtf8("Ясно, буран, гроза");
-    forecastList[QString::fromUtf8("d.sun.c1.s1.st.png")]   = QString::fromUtf8("Малооблачно, небольшой снег, гроза");
-    forecastList[QString::fromUtf8("d.sun.c1.s2.st.png")]   = QString::fromUtf8("Малооблачно, снег, гроза");
-    forecastList[QString::fromUtf8("d.sun.c1.s3.st.png")]   = QString::fromUtf8("Малооблачно, сильный снег, гроза");
-    forecastList[QString::fromUtf8("d.sun.c1.s4.st.png")]   = QString::fromUtf8("Малооблачно, буран, гроза");
-    forecastList[QString::fromUtf8("d.sun.c2.s1.st.png")]   = QString::fromUtf8("Малооблачно, небольшой снег, гроза");
-    forecastList[QString::fromUtf8("d.sun.c2.s2.st.png")]   = QString::fromUtf8("Малооблачно, снег, гроза");
-    forecastList[QString::fromUtf8("d.sun.c2.s3.st.png")]   = QString::fromUtf8("Малооблачно, сильный снег, гроза");
-    forecastList[QString::fromUtf8("d.sun.c2.s4.st.png")]   = QString::fromUtf8("Малооблачно, буран, гроза");
-    forecastList[QString::fromUtf8("d.sun.c3.s1.st.png")]   = QString::fromUtf8("Облачно, небольшой снег, гроза");
-    forecastList[QString::fromUtf8("d.sun.c3.s2.st.png")]   = QString::fromUtf8("Облачно, снег, гроза");
-    forecastList[QString::fromUtf8("d.sun.c3.s3.st.png")]   = QString::fromUtf8("Облачно, сильный снег, гроза");
-    forecastList[QString::fromUtf8("d.sun.c3.s4.st.png")]   = QString::fromUtf8("Облачно, буран, гроза");
-    forecastList[QString::fromUtf8("d.sun.c4.s1.st.png")]   = QString::fromUtf8("Пасмурно, небольшой снег, гроза");
-    forecastList[QString::fromUtf8("d.sun.c4.s2.st.png")]   = QString::fromUtf8("Пасмурно, снег, гроза");
-    forecastList[QString::fromUtf8("d.sun.c4.s3.st.png")]   = QString::fromUtf8("Пасмурно, сильный снег, гроза");
-    forecastList[QString::fromUtf8("d.sun.c4.s4.st.png")]   = QString::fromUtf8("Пасмурно, буран, гроза");
-
-    return forecastList;
-}
-
-QMap<QString, QString> EnvGismeteoIon::setupDayMappings(void) const
-{
-    QMap<QString, QString> days;
-    days[QString::fromUtf8("пн")] = QDate::shortDayName(1, QDate::StandaloneFormat);
-    days[QString::fromUtf8("вт")] = QDate::shortDayName(2, QDate::StandaloneFormat);
-    days[QString::fromUtf8("ср")] = QDate::shortDayName(3, QDate::StandaloneFormat);
-    days[QString::fromUtf8("чт")] = QDate::shortDayName(4, QDate::StandaloneFormat);
-    days[QString::fromUtf8("пт")] = QDate::shortDayName(5, QDate::StandaloneFormat);
-    days[QString::fromUtf8("сб")] = QDate::shortDayName(6, QDate::StandaloneFormat);
-    days[QString::fromUtf8("вс")] = QDate::shortDayName(7, QDate::StandaloneFormat);
-    return days;
-}
-
-QMap<QString, IonInterface::WindDirections> EnvGismeteoIon::setupWindIconMappings(void) const
-{
-    QMap<QString, WindDirections> windDir;
-    windDir[QString::fromUtf8("с")] = N;
-    windDir[QString::fromUtf8("св")] = NE;
-    windDir[QString::fromUtf8("ю")] = S;
-    windDir[QString::fromUtf8("юз")] = SW;
-    windDir[QString::fromUtf8("в")] = E;
-    windDir[QString::fromUtf8("юв")] = SE;
-    windDir[QString::fromUtf8("з")] = W;
-    windDir[QString::fromUtf8("сз")] = NW;
-    windDir[QString::fromUtf8("")] = VR;
-    return windDir;
-}
-
-QMap<QString, IonInterface::ConditionIcons> const& EnvGismeteoIon::conditionIcons(void) const
-{
-    static QMap<QString, ConditionIcons> const condval = setupConditionIconMappings();
-    return condval;
-}
-
-QMap<QString, IonInterface::ConditionIcons> const& EnvGismeteoIon::forecastIcons(void) const
-{
-    static QMap<QString, ConditionIcons> const foreval = setupForecastIconMappings();
-    return foreval;
-}
-
-QMap<QString, QString> const& EnvGismeteoIon::forecastConditions(void) const
-{
-    static QMap<QString, QString> const foreval = setupForecastConditionMappings();
-    return foreval;
-}
-
-QMap<QString, QString> const& EnvGismeteoIon::dayMap(void) const
-{
-    static QMap<QString, QString> const dayval = setupDayMappings();
-    return dayval;
-}
+    if (precipitation == WeatherIcon::NoPrecipitation) {
+        if (WeatherIcon::thunderstorm(icon)) {
+            // Dry thunderstorm, only likely under clear or light clouds
+            return thunderstormIcons[night][clouds < 3 ? ChanceCategory : HeavyCategory];
+        }
+        return cloudIcons[night][clouds];
+    }
 
-QMap<QString, IonInterface::WindDirections> const& EnvGismeteoIon::windIcons(void) const
-{
-    static QMap<QString, WindDirections> const wval = setupWindIconMappings();
-    return wval;
+    const IconCategory category = iconCategories[clouds][WeatherIcon::intensity(icon) - 1];
+    if (WeatherIcon::thunderstorm(icon)) {
+        return thunderstormIcons[night][category];
+    }
+    return precipitation == WeatherIcon::Rain ? rainIcons[night][category] : snowIcons[night][category];
 }
 
 // Get a specific Ion's data
 bool EnvGismeteoIon::updateIonSource(const QString& source)
 {
-    kDebug() << "updateIonSource()" << source;
+    gismeteoTrace(Network) << "updateIonSource()" << source;
 
     // We expect the applet to send the source in the following tokenization:
     // ionname|validate|place_name - Triggers validation of place
     // ionname|weather|place_name - Triggers receiving weather of place
+    // ionname|weather|place_name|code|hourly - Same with hourly forecast
+    // ionname|batch|code,code,... - Triggers receiving weather of several cities
+    // ionname|stats - Latency and throughput statistics of the ion
 
     QStringList sourceAction = source.split('|');
 
@@ -549,8 +323,33 @@ bool EnvGismeteoIon::updateIonSource(const QString& source)
     }
 
     if (sourceAction[1] == "validate" && sourceAction.size() > 2) {
+        const QString query = GismeteoPlaceIndex::normalize(sourceAction[2]);
+
+        // Cities from local catalogue go first, names not in it are
+        // looked up on the site
+        const QList<XMLMapInfo> places = m_catalogue.find(query);
+        if (!places.isEmpty()) {
+            validate(source, places);
+            return true;
+        }
+
+        // Answer from cache, stale results are refreshed in background
+        if (m_places.contains(query)) {
+            validate(source);
+            if (m_places.isFresh(query)) {
+                return true;
+            }
+        } else if (findPlaceLocally(query, source)) {
+            return true;
+        }
         findPlace(sourceAction[2], source);
         return true;
+    } else if (sourceAction[1] == "stats") {
+        publishStats(source);
+        return true;
+    } else if (sourceAction[1] == "batch" && sourceAction.size() > 2) {
+        getBatchWeather(source, sourceAction[2].split(',', QString::SkipEmptyParts));
+        return true;
     } else if (sourceAction[1] == "weather" && sourceAction.size() > 3) {
         getWeather(sourceAction[3], source);
         return true;
@@ -561,228 +360,811 @@ bool EnvGismeteoIon::updateIonSource(const QString& source)
     return false;
 }
 
+static bool isHourlySource(const QString& source)
+{
+    return source.section('|', 4, 4) == "hourly";
+}
+
+static bool isBatchSource(const QString& source)
+{
+    return source.section('|', 1, 1) == "batch";
+}
+
 // Gets weather for a city
 void EnvGismeteoIon::getWeather(const QString& code, const QString& source)
 {
-    foreach (const QString &fetching, m_jobList) {
-        if (fetching == source) {
-            // already getting this source and awaiting the data
+    if (!isCityCode(code)) {
+        setData(source, "validate", QString("gismeteo|invalid|single|%1").arg(code));
+        return;
+    }
+
+    // Hourly table is parsed for the city from now on
+    const bool hourly = isHourlySource(source);
+    if (hourly) {
+        m_hourlyCodes.insert(code);
+    }
+
+    // Fall back to weather saved last time
+    if (!m_weatherData.contains(code)) {
+        CachedWeather cached;
+        if (m_diskCache.load(code, cached.data)) {
+            m_weatherData.insert(code, cached, cached.data.updated.toMSecsSinceEpoch());
+        }
+    }
+
+    if (m_weatherData.contains(code)) {
+        // Fresh weather is served without going to network, unless
+        // hourly rows are wanted and it was parsed without them
+        if (m_weatherData.isFresh(code) && (!hourly || m_weatherData.object(code)->data.hasHourly)) {
+            updateWeather(source, code);
             return;
         }
+
+        // Stale one is shown while the page is being downloaded
+        updateWeather(source, code, true);
+    }
+
+    // Site failed for this city recently, don't retry yet
+    QHash<QString, Backoff>::const_iterator backoff = m_backoff.constFind(code);
+    if (backoff != m_backoff.constEnd() && backoff.value().retryAt > QDateTime::currentMSecsSinceEpoch()) {
+        gismeteoTrace(Network) << "Backing off" << code;
+        if (!m_weatherData.contains(code)) {
+            weatherUnavailable(source, code);
+        }
+        return;
     }
 
-    kDebug() << source;
+    // One download per city, every source waiting on it gets the result
+    QHash<QString, QStringList>::iterator waiting = m_waitingSources.find(code);
+    if (waiting != m_waitingSources.end()) {
+        if (!waiting.value().contains(source)) {
+            waiting.value().append(source);
+        }
+        return;
+    }
+    m_waitingSources.insert(code, QStringList() << source);
 
-    KUrl url = QString("http://www.gismeteo.ru/city/daily/" + code + "/");
-    //url = "file:///home/alex/Develop/kde/plasma-ion-gismeteo/4368.html";
-    kDebug() << "Will Try URL: " << url;
+    gismeteoTrace(Network) << source;
 
-    KIO::TransferJob* const newJob  = KIO::get(url.url(), KIO::Reload, KIO::HideProgressInfo);
+    KUrl url = QString(m_baseUrl + "city/daily/" + code + "/");
+    m_scheduler->schedule("weather|" + code, url, GismeteoFetchScheduler::Background);
+}
 
-    m_jobXml.insert(newJob, QByteArray());
-    m_jobList.insert(newJob, source);
+// Scheduler lets a download start
+void EnvGismeteoIon::slotFetchReady(const QString& id, const KUrl& url)
+{
+    gismeteoTrace(Network) << "Will Try URL: " << url;
+
+    const QString key = id.section('|', 1);
+    if (id.startsWith("weather|")) {
+        startWeatherJob(key, url);
+    } else {
+        startSearchJob(key, url);
+    }
+}
+
+void EnvGismeteoIon::startWeatherJob(const QString& code, const KUrl& url)
+{
+    KIO::TransferJob* const newJob  = KIO::get(url.url(), KIO::Reload, KIO::HideProgressInfo);
+    const bool hourly = m_hourlyCodes.contains(code);
+
+    // Page can only be revalidated if we still have what was parsed from it
+    const CachedWeather *cached = m_weatherData.object(code);
+    const HttpValidators validators = cached && (!hourly || cached->data.hasHourly) ? cached->validators : HttpValidators();
+    setupConditionalRequest(newJob, validators);
+
+    WeatherJob weatherJob;
+    weatherJob.code = code;
+    weatherJob.hourly = hourly;
+    weatherJob.conditional = !validators.etag.isEmpty() || !validators.lastModified.isEmpty();
+    const bool useStreamParser = m_useStreamParser && GismeteoStreamParser::isSupported(hourly);
+    weatherJob.parser = useStreamParser ? new GismeteoStreamParser(hourly) : 0;
+    weatherJob.scanner = !useStreamParser && m_earlyTermination ? new GismeteoSectionScanner() : 0;
+    weatherJob.parseNsecs = 0;
+    m_jobs.insert(newJob, weatherJob);
+    m_transfers[newJob].start();
 
     connect(newJob, SIGNAL(data(KIO::Job*,QByteArray)), this,
             SLOT(slotDataArrived(KIO::Job*,QByteArray)));
     connect(newJob, SIGNAL(result(KJob*)), this, SLOT(slotJobFinished(KJob*)));
+    if (!weatherJob.parser) {
+        connect(newJob, SIGNAL(totalSize(KJob*,qulonglong)), this, SLOT(slotTotalSize(KJob*,qulonglong)));
+    }
+}
+
+// Gets weather for several cities into one source
+void EnvGismeteoIon::getBatchWeather(const QString& source, const QStringList& codes)
+{
+    QStringList cities;
+    foreach (const QString &code, codes) {
+        const QString city = code.trimmed();
+        if (city.isEmpty()) {
+            continue;
+        }
+        if (!isCityCode(city)) {
+            setData(source, "validate", QString("gismeteo|invalid|single|%1").arg(city));
+            return;
+        }
+        if (!cities.contains(city)) {
+            cities.append(city);
+        }
+    }
+
+    // Keys shared by all cities, only set when the source is new
+    Plasma::DataContainer *container = containerForSource(source);
+    if (!container || !container->data().contains("Cities")) {
+        Plasma::DataEngine::Data data;
+        data.insert("Cities", cities.join(","));
+        data.insert("Credit", i18n("Meteorological data is provided by Gismeteo"));
+        data.insert("Credit Url", "http://www.gismeteo.ru/");
+        setData(source, data);
+    }
+
+    // Downloads are queued together, every city is published as it is done
+    foreach (const QString &code, cities) {
+        getWeather(code, source);
+    }
+}
+
+// Answer refined search from places found before
+bool EnvGismeteoIon::findPlaceLocally(const QString& query, const QString& source)
+{
+    // Results of a fresh search for a shorter query include all
+    // places matching this one, and they all are in the index, unless
+    // the site cut the list short
+    for (int size = query.size() - 1; size > 0; --size) {
+        const QString prefix = query.left(size);
+        if (!m_places.isFresh(prefix)) {
+            continue;
+        }
+        if (m_places.object(prefix)->places.size() >= maxSearchResults) {
+            return false;
+        }
+
+        // Nothing found is answered by the site, not by us. Fewer places
+        // than the shorter search has mean some were evicted since.
+        const QList<XMLMapInfo> places = m_placeIndex.find(query);
+        int expected = 0;
+        foreach (const XMLMapInfo &place, m_places.object(prefix)->places) {
+            if (GismeteoPlaceIndex::normalize(place.name).startsWith(query)) {
+                ++expected;
+            }
+        }
+        if (places.isEmpty() || places.size() < expected) {
+            return false;
+        }
+        validate(source, places);
+        return true;
+    }
+    return false;
 }
 
 // Search for a city
 void EnvGismeteoIon::findPlace(const QString& place, const QString& source)
 {
-    KUrl url = QString("http://www.gismeteo.ru/city/?gis0=" + place + "&searchQueryData=");
-    //url = "file:///home/alex/Develop/kde/plasma-ion-gismeteo/search.html";
-    kDebug() << "Will Try URL: " << url;
+    const QString query = GismeteoPlaceIndex::normalize(place);
+
+    // One search per query, every source waiting on it gets the result
+    QHash<QString, QStringList>::iterator waiting = m_searchWaitingSources.find(query);
+    if (waiting != m_searchWaitingSources.end()) {
+        if (!waiting.value().contains(source)) {
+            waiting.value().append(source);
+        }
+        return;
+    }
+    m_searchWaitingSources.insert(query, QStringList() << source);
 
+    // User is waiting for search results, they go before weather
+    KUrl url = QString(m_baseUrl + "city/?gis0=" + place + "&searchQueryData=");
+    m_scheduler->schedule("search|" + query, url, GismeteoFetchScheduler::Interactive);
+}
+
+void EnvGismeteoIon::startSearchJob(const QString& query, const KUrl& url)
+{
     KIO::TransferJob* const newJob  = KIO::get(url.url(), KIO::Reload, KIO::HideProgressInfo);
 
-    m_searchJobXml.insert(newJob, QByteArray());
-    m_searchJobList.insert(newJob, source);
+    const CachedPlaces *cached = m_places.object(query);
+    const HttpValidators validators = cached ? cached->validators : HttpValidators();
+    setupConditionalRequest(newJob, validators);
+
+    SearchJob searchJob;
+    searchJob.query = query;
+    searchJob.conditional = !validators.etag.isEmpty() || !validators.lastModified.isEmpty();
+    m_searchJobs.insert(newJob, searchJob);
+    m_transfers[newJob].start();
 
     connect(newJob, SIGNAL(data(KIO::Job*,QByteArray)), this,
             SLOT(setup_slotDataArrived(KIO::Job*,QByteArray)));
+    connect(newJob, SIGNAL(totalSize(KJob*,qulonglong)), this, SLOT(slotTotalSize(KJob*,qulonglong)));
     connect(newJob, SIGNAL(result(KJob*)), this, SLOT(setup_slotJobFinished(KJob*)));
 }
 
 void EnvGismeteoIon::slotDataArrived(KIO::Job *job, const QByteArray &data)
 {
-    if (data.isEmpty() || !m_jobXml.contains(job)) {
+    if (data.isEmpty()) {
         return;
     }
 
-    m_jobXml[job].append(data);
+    QHash<KJob *, WeatherJob>::iterator it = m_jobs.find(job);
+    if (it == m_jobs.end()) {
+        return;
+    }
+
+    m_transfers[job].received(data.size());
+
+    WeatherJob &weatherJob = it.value();
+    bool complete = false;
+
+    if (weatherJob.parser) {
+        QElapsedTimer timer;
+        timer.start();
+        weatherJob.parser->feed(data);
+        weatherJob.parseNsecs += timer.nsecsElapsed();
+        complete = m_earlyTermination && weatherJob.parser->isComplete();
+    } else {
+        weatherJob.html.append(data);
+        if (weatherJob.scanner) {
+            weatherJob.scanner->feed(data);
+            complete = weatherJob.scanner->isComplete();
+        }
+    }
+
+    // Everything we need is here, don't wait for the rest of the page
+    if (complete) {
+        gismeteoTrace(Network) << "All sections parsed, stopping download of" << weatherJob.code;
+        finishWeatherJob(job);
+        job->kill(KJob::Quietly);
+    }
 }
 
 void EnvGismeteoIon::slotJobFinished(KJob *job)
 {
-    // Dual use method, if we're fetching location data to parse we need to do this first
-    const QString source = m_jobList.value(job);
-    setData(source, Data());
+    finishWeatherJob(job);
+}
+
+void EnvGismeteoIon::finishWeatherJob(KJob *job)
+{
+    if (!m_jobs.contains(job)) {
+        return;
+    }
+
+    WeatherJob weatherJob = m_jobs.take(job);
+    delete weatherJob.scanner;
+    m_transfers.take(job).finish();
+    m_scheduler->finished("weather|" + weatherJob.code);
+
+    KIO::Job *kioJob = static_cast<KIO::Job *>(job);
+
+    if (isFailed(kioJob)) {
+        kDebug() << "Failed to download weather for" << weatherJob.code << job->errorString();
+        delete weatherJob.parser;
+        weatherFailed(weatherJob.code);
+        return;
+    }
+
+    // Page has not changed, publish what we have got before
+    if (isNotModified(kioJob)) {
+        gismeteoTrace(Network) << "Not modified" << weatherJob.code;
+        delete weatherJob.parser;
+
+        // It is as fresh as a new page would be
+        if (m_weatherData.contains(weatherJob.code)) {
+            const CachedWeather previous = *m_weatherData.object(weatherJob.code);
+            m_weatherData.insert(weatherJob.code, previous);
+            publishWeather(weatherJob.code);
+            return;
+        }
+
+        // Evicted during download, there is no body to parse. Validators
+        // went away with it, so the page is fetched in full next time.
+        if (weatherJob.conditional) {
+            m_scheduler->schedule("weather|" + weatherJob.code, static_cast<KIO::TransferJob *>(job)->url(),
+                                  GismeteoFetchScheduler::Background);
+        } else {
+            weatherFailed(weatherJob.code);
+        }
+        return;
+    }
+
+    m_parseValidators.insert("weather|" + weatherJob.code, responseValidators(kioJob));
 
-    const QByteArray &data = m_jobXml.value(job);
-    readHTMLData(source, data);
-    updateWeather(source);
+    GismeteoStats::self()->add(GismeteoStats::WeatherPages);
 
-    m_jobList.remove(job);
-    m_jobXml.remove(job);
+    // Stream parser is done as soon as data is over
+    if (weatherJob.parser) {
+        QElapsedTimer timer;
+        timer.start();
+        weatherJob.parser->finish();
+        GismeteoStats::self()->record(GismeteoStats::StreamParse, weatherJob.parseNsecs + timer.nsecsElapsed());
+
+        const WeatherData data = weatherJob.parser->weatherData();
+        const bool ok = weatherJob.parser->isValid();
+        delete weatherJob.parser;
+
+        slotWeatherParsed(weatherJob.code, data, ok);
+        return;
+    }
+
+    // Parsing is done in the worker pool, results come to slotWeatherParsed().
+    // Query of the hourly table is appended to the daily one.
+    QStringList query;
+    query << queryFile("gismeteo.xq");
+    if (weatherJob.hourly) {
+        query << queryFile("gismeteo-hourly.xq");
+    }
+    m_parsePool->parse(GismeteoParsePool::Weather, weatherJob.code, query, weatherJob.html.toByteArray());
 }
 
 void EnvGismeteoIon::setup_slotDataArrived(KIO::Job *job, const QByteArray &data)
 {
-    if (data.isEmpty() || !m_searchJobXml.contains(job)) {
+    if (data.isEmpty()) {
+        return;
+    }
+
+    QHash<KJob *, SearchJob>::iterator it = m_searchJobs.find(job);
+    if (it == m_searchJobs.end()) {
+        return;
+    }
+
+    m_transfers[job].received(data.size());
+    it.value().html.append(data);
+}
+
+// Content-Length is known, page for XQuery can be allocated at once
+void EnvGismeteoIon::slotTotalSize(KJob *job, qulonglong size)
+{
+    QHash<KJob *, WeatherJob>::iterator weather = m_jobs.find(job);
+    if (weather != m_jobs.end()) {
+        weather.value().html.setSizeHint(size);
         return;
     }
 
-    m_searchJobXml[job].append(data);
+    QHash<KJob *, SearchJob>::iterator search = m_searchJobs.find(job);
+    if (search != m_searchJobs.end()) {
+        search.value().html.setSizeHint(size);
+    }
 }
 
 void EnvGismeteoIon::setup_slotJobFinished(KJob *job)
 {
-    // Dual use method, if we're fetching location data to parse we need to do this first
-    const QString source = m_searchJobList.value(job);
-    setData(source, Data());
+    const SearchJob searchJob = m_searchJobs.take(job);
+    const QString query = searchJob.query;
+    m_transfers.take(job).finish();
+    m_scheduler->finished("search|" + query);
+
+    KIO::Job *kioJob = static_cast<KIO::Job *>(job);
 
-    const QByteArray &data = m_searchJobXml.value(job);
-    readSearchHTMLData(source, data);
-    validate(source);
+    if (isFailed(kioJob)) {
+        kDebug() << "Failed to search for" << query << job->errorString();
 
-    m_searchJobList.remove(job);
-    m_searchJobXml.remove(job);
+        // Older results are still better than nothing
+        if (m_places.contains(query)) {
+            publishPlaces(query);
+        } else {
+            foreach (const QString &source, m_searchWaitingSources.take(query)) {
+                if (!suggestPlaces(source, query)) {
+                    setData(source, "validate", "gismeteo|timeout");
+                }
+            }
+        }
+        return;
+    }
+
+    // Search results have not changed
+    if (isNotModified(kioJob)) {
+        if (m_places.contains(query)) {
+            const CachedPlaces previous = *m_places.object(query);
+            m_places.insert(query, previous);
+            publishPlaces(query);
+        } else if (searchJob.conditional) {
+            // Evicted during download, search again without validators
+            m_scheduler->schedule("search|" + query, static_cast<KIO::TransferJob *>(job)->url(),
+                                  GismeteoFetchScheduler::Interactive);
+        } else {
+            foreach (const QString &source, m_searchWaitingSources.take(query)) {
+                if (!suggestPlaces(source, query)) {
+                    setData(source, "validate", "gismeteo|timeout");
+                }
+            }
+        }
+        return;
+    }
+
+    m_parseValidators.insert("search|" + query, responseValidators(kioJob));
+
+    GismeteoStats::self()->add(GismeteoStats::SearchPages);
+    m_parsePool->parse(GismeteoParsePool::Search, query, QStringList() << queryFile("gismeteo-search.xq"),
+                       searchJob.html.toByteArray());
 }
 
-// Parse Weather
-bool EnvGismeteoIon::readHTMLData(const QString& source, const QByteArray& xml)
+void EnvGismeteoIon::slotWeatherParsed(const QString &code, const WeatherData &data, bool ok)
 {
-    WeatherData data;
+    // Validators are cached only along with values parsed from the page
+    const HttpValidators validators = m_parseValidators.take("weather|" + code);
+
+    if (!ok) {
+        kDebug() << "Failed to parse weather for" << code;
+        weatherFailed(code);
+        return;
+    }
 
-    QXmlQuery query;
+    m_backoff.remove(code);
 
-    kDebug() << "readHTMLData()";
+    // Page has the same values, treat it like not modified
+    const CachedWeather *previous = m_weatherData.object(code);
+    if (previous && previous->data.hasSameValues(data)) {
+        CachedWeather weather = *previous;
+        weather.validators = validators;
+        m_weatherData.insert(code, weather);
+        publishWeather(code);
+        return;
+    }
 
-    // Setup model
-    QLibXmlNodeModel model(query.namePool(), xml, QUrl());
-    query.setFocus(model.dom());
+    CachedWeather weather;
+    weather.data = data;
+    weather.data.updated = QDateTime::currentDateTime();
+    weather.validators = validators;
+    m_weatherData.insert(code, weather);
+    m_diskCache.save(code, weather.data);
 
-    // Setup query
-    QFile queryFile;
-    queryFile.setFileName(KGlobal::dirs()->findResource("data", "plasma-ion-gismeteo/gismeteo.xq"));
-    if (!queryFile.open(QIODevice::ReadOnly)) {
-        kDebug() << "Can't open XQuery file" << queryFile.fileName();
-        return false;
+    publishWeather(code);
+}
+
+// Keep the last good weather and retry later, waiting longer each time
+void EnvGismeteoIon::weatherFailed(const QString &code)
+{
+    Backoff &backoff = m_backoff[code];
+    const qint64 delay = qMin(maxRetryDelay, minRetryDelay << qMin(backoff.failures, 16));
+    ++backoff.failures;
+    backoff.retryAt = QDateTime::currentMSecsSinceEpoch() + delay;
+
+    if (m_weatherData.contains(code)) {
+        publishWeather(code, true);
+    } else {
+        foreach (const QString &source, m_waitingSources.take(code)) {
+            weatherUnavailable(source, code);
+        }
     }
-    query.setQuery(&queryFile, QUrl::fromLocalFile(queryFile.fileName()));
+}
 
-    if (!query.isValid()) {
-        kDebug() << "query is not valid";
-        return false;
+// Nothing to show for a city, tell the source instead of leaving it
+// waiting. Weather published later replaces the key.
+void EnvGismeteoIon::weatherUnavailable(const QString &source, const QString &code)
+{
+    if (isBatchSource(source)) {
+        Plasma::DataEngine::Data data;
+        data.insert("validate", "gismeteo|timeout");
+        publishCityData(source, code, data);
+    } else {
+        setData(source, "validate", "gismeteo|timeout");
+    }
+}
+
+// Publish weather of a city to all sources waiting for it
+void EnvGismeteoIon::publishWeather(const QString &code, bool cached)
+{
+    foreach (const QString &source, m_waitingSources.take(code)) {
+        updateWeather(source, code, cached);
     }
+}
 
-    // Setup a formatter
-    Receiver receiver(query.namePool(), data);
+// Sets only values that differ from what the source has and removes
+// keys that are gone, nothing is sent if data is the same. With owned
+// keys only they can be gone, they are replaced with keys of data.
+void EnvGismeteoIon::publishData(const QString& source, const Plasma::DataEngine::Data& data, QStringList *ownedKeys)
+{
+    Plasma::DataContainer *container = containerForSource(source);
+    if (!container) {
+        setData(source, data);
+        if (ownedKeys) {
+            *ownedKeys = data.keys();
+        }
+        return;
+    }
 
-    // Evaluate query
-    query.evaluateTo(&receiver);
+    const Plasma::DataEngine::Data old = container->data();
 
-    m_weatherData[source] = data;
+    Plasma::DataEngine::Data changed;
+    for (Plasma::DataEngine::Data::const_iterator it = data.constBegin(); it != data.constEnd(); ++it) {
+        Plasma::DataEngine::Data::const_iterator oldValue = old.constFind(it.key());
+        if (oldValue == old.constEnd() || oldValue.value() != it.value()) {
+            changed.insert(it.key(), it.value());
+        }
+    }
 
-    return true;
+    if (ownedKeys) {
+        foreach (const QString &key, *ownedKeys) {
+            if (!data.contains(key)) {
+                removeData(source, key);
+            }
+        }
+        *ownedKeys = data.keys();
+    } else {
+        for (Plasma::DataEngine::Data::const_iterator it = old.constBegin(); it != old.constEnd(); ++it) {
+            if (!data.contains(it.key())) {
+                removeData(source, it.key());
+            }
+        }
+    }
+
+    if (!changed.isEmpty()) {
+        setData(source, changed);
+    }
 }
 
-// Parse search results
-bool EnvGismeteoIon::readSearchHTMLData(const QString& source, const QByteArray& xml)
+// Cities of a batch source share it, their keys are prefixed with the code.
+// Only keys published for this city before are checked for removal, so
+// the cost doesn't grow with the number of cities in the source.
+void EnvGismeteoIon::publishCityData(const QString& source, const QString& code, const Plasma::DataEngine::Data& data)
 {
-    QList<XMLMapInfo> data;
+    const QString prefix = code + '|';
+    Plasma::DataEngine::Data cityData;
+    for (Plasma::DataEngine::Data::const_iterator it = data.constBegin(); it != data.constEnd(); ++it) {
+        cityData.insert(prefix + it.key(), it.value());
+    }
+    publishData(source, cityData, &m_batchKeys[source][code]);
+
+    gismeteoTrace(Payload) << cityData;
+}
 
-    QXmlQuery query;
+void EnvGismeteoIon::slotNetworkStatusChanged(Solid::Networking::Status status)
+{
+    // Unknown status means there is no network management, just try
+    const bool online = status == Solid::Networking::Connected || status == Solid::Networking::Unknown;
+    if (online == !m_scheduler->isSuspended()) {
+        return;
+    }
 
-    kDebug() << "readSearchHTMLData()" << source << xml;
+    kDebug() << "Network is" << (online ? "up" : "down");
 
-    // Setup model
-    QLibXmlNodeModel model(query.namePool(), xml, QUrl("file:///search"));
-    query.setFocus(model.dom());
+    // Failures were likely caused by the network being down
+    if (online) {
+        m_backoff.clear();
+    }
+    m_scheduler->setSuspended(!online);
+}
 
-    // Setup query
-    QFile queryFile;
-    queryFile.setFileName(KGlobal::dirs()->findResource("data", "plasma-ion-gismeteo/gismeteo-search.xq"));
-    if (!queryFile.open(QIODevice::ReadOnly)) {
-        kDebug() << "Can't open XQuery file" << queryFile.fileName();
-        return false;
+// Cities a weather or batch source shows
+static QStringList sourceCodes(const QString& source)
+{
+    const QString action = source.section('|', 1, 1);
+    if (action == "weather") {
+        return QStringList() << source.section('|', 3, 3);
+    } else if (action == "batch") {
+        return source.section('|', 2, 2).split(',', QString::SkipEmptyParts);
     }
-    query.setQuery(&queryFile, QUrl::fromLocalFile(queryFile.fileName()));
+    return QStringList();
+}
 
-    if (!query.isValid()) {
-        kDebug() << "query is not valid";
-        return false;
+// Forget keys published to the source, drop queued downloads nobody
+// waits for any more and stop parsing hourly table of a city once
+// nobody shows it
+void EnvGismeteoIon::slotSourceRemoved(const QString& source)
+{
+    m_batchKeys.remove(source);
+
+    foreach (const QString &code, sourceCodes(source)) {
+        QHash<QString, QStringList>::iterator waiting = m_waitingSources.find(code.trimmed());
+        if (waiting == m_waitingSources.end()) {
+            continue;
+        }
+        waiting.value().removeAll(source);
+        if (waiting.value().isEmpty()) {
+            m_waitingSources.erase(waiting);
+            m_scheduler->cancel("weather|" + code.trimmed());
+        }
+    }
+
+    if (!isHourlySource(source)) {
+        return;
+    }
+
+    const QString code = source.section('|', 3, 3);
+    foreach (const QString &other, sources()) {
+        if (other != source && isHourlySource(other) && other.section('|', 3, 3) == code) {
+            return;
+        }
+    }
+    m_hourlyCodes.remove(code);
+}
+
+void EnvGismeteoIon::slotSearchParsed(const QString &query, const QList<XMLMapInfo> &places, bool ok)
+{
+    const HttpValidators validators = m_parseValidators.take("search|" + query);
+
+    if (!ok) {
+        kDebug() << "Failed to parse search results for" << query;
+
+        // Last good results are kept as they were, partial ones aren't cached
+        if (m_places.contains(query)) {
+            publishPlaces(query);
+        } else {
+            foreach (const QString &source, m_searchWaitingSources.take(query)) {
+                if (!suggestPlaces(source, query)) {
+                    setData(source, "validate", "gismeteo|timeout");
+                }
+            }
+        }
+        return;
     }
 
-    // Setup a formatter
-    SearchReceiver receiver(query.namePool(), data);
+    CachedPlaces cached;
+    cached.places = places;
+    cached.validators = validators;
+    m_places.insert(query, cached);
+    m_placeIndex.add(places);
+    publishPlaces(query);
+}
 
-    // Evaluate query
-    query.evaluateTo(&receiver);
+// Publish search results to all sources waiting for them
+void EnvGismeteoIon::publishPlaces(const QString &query)
+{
+    const CachedPlaces *cached = m_places.object(query);
+    foreach (const QString &source, m_searchWaitingSources.take(query)) {
+        if (cached && cached->places.isEmpty() && suggestPlaces(source, query)) {
+            continue;
+        }
+        validate(source);
+    }
+}
 
-    m_places[source] = data;
+// Site knows no such place, offer catalogue cities with a similar name
+bool EnvGismeteoIon::suggestPlaces(const QString& source, const QString& query)
+{
+    const QList<XMLMapInfo> suggestions = m_catalogue.suggest(query);
+    if (suggestions.isEmpty()) {
+        return false;
+    }
 
+    validate(source, suggestions, true);
     return true;
 }
 
-void EnvGismeteoIon::updateWeather(const QString& source)
+void EnvGismeteoIon::publishStats(const QString& source)
+{
+    GismeteoStats *stats = GismeteoStats::self();
+    Plasma::DataEngine::Data data;
+
+    // Latencies are in milliseconds
+    for (int i = 0; i < GismeteoStats::StageCount; ++i) {
+        const GismeteoStats::Stage stage = GismeteoStats::Stage(i);
+        const GismeteoStats::Summary summary = stats->summary(stage);
+        const QString name = GismeteoStats::stageName(stage);
+
+        data.insert(name + " Count", summary.count);
+        data.insert(name + " p50", summary.p50 / 1e6);
+        data.insert(name + " p95", summary.p95 / 1e6);
+        data.insert(name + " p99", summary.p99 / 1e6);
+        data.insert(name + " Max", summary.max / 1e6);
+    }
+
+    for (int i = 0; i < GismeteoStats::CounterCount; ++i) {
+        const GismeteoStats::Counter counter = GismeteoStats::Counter(i);
+        data.insert(GismeteoStats::counterName(counter), stats->counter(counter));
+    }
+
+    setData(source, data);
+}
+
+// Typed values are turned into strings only here, when handed to the engine
+static QString valueString(qint16 value)
 {
+    return value == WeatherData::NoValue ? QString() : QString::number(value);
+}
+
+// Conditions are in Russian as on the site, empty one has nothing to translate
+static QString conditionString(const QString& condition)
+{
+    return condition.isEmpty() ? condition : i18nc("weather condition", condition.toUtf8());
+}
+
+static QString windDirectionString(quint8 direction)
+{
+    switch (direction) {
+    case WeatherData::North:        return "N";
+    case WeatherData::NorthEast:    return "NE";
+    case WeatherData::East:         return "E";
+    case WeatherData::SouthEast:    return "SE";
+    case WeatherData::South:        return "S";
+    case WeatherData::SouthWest:    return "SW";
+    case WeatherData::West:         return "W";
+    case WeatherData::NorthWest:    return "NW";
+    default:                        return "VR";
+    }
+}
+
+void EnvGismeteoIon::updateWeather(const QString& source, const QString& code, bool cached)
+{
+    GismeteoStageTimer publishTimer(GismeteoStats::Publish);
     Plasma::DataEngine::Data data;
 
-    kDebug() << "updateWeather()";
+    gismeteoTrace(Publish) << "updateWeather()" << source << code;
+
+    const WeatherData weather = m_weatherData.value(code).data;
 
     // Real weather - Current conditions
-    data.insert("Current Conditions", i18nc("weather condition", m_weatherData[source].condition.toUtf8()));
-    data.insert("Condition Icon", getWeatherIcon(forecastIcons(), m_weatherData[source].conditionIcon));
+    data.insert("Current Conditions", conditionString(weather.condition));
+    data.insert("Condition Icon", getWeatherIcon(conditionIcon(weather.conditionIcon)));
 
-    data.insert("Temperature", m_weatherData[source].temperature);
+    data.insert("Temperature", valueString(weather.temperature));
     data.insert("Temperature Unit", QString::number(KUnitConversion::Celsius));
 
-    data.insert("Pressure", m_weatherData[source].pressure);
+    data.insert("Pressure", valueString(weather.pressure));
     data.insert("Pressure Unit", QString::number(KUnitConversion::MillimetersOfMercury));
 
-    data.insert("Humidity", m_weatherData[source].humidity);
+    data.insert("Humidity", valueString(weather.humidity));
     data.insert("Humidity Unit", QString::number(KUnitConversion::Percent));
 
-    data.insert("Wind Speed", m_weatherData[source].windSpeed);
+    data.insert("Wind Speed", valueString(weather.windSpeed));
     data.insert("Wind Speed Unit", QString::number(KUnitConversion::MeterPerSecond));
-    data.insert("Wind Direction", getWindDirectionIcon(windIcons(), m_weatherData[source].windDirection));
+    data.insert("Wind Direction", windDirectionString(weather.windDirection));
 
-    data.insert("Water Temperature", m_weatherData[source].waterTemperature);
+    data.insert("Water Temperature", valueString(weather.waterTemperature));
 
-    int dayIndex = 0;
-    foreach(const WeatherData::Forecast &forecast, m_weatherData[source].forecasts) {
+    const int forecastSize = weather.forecastSize();
+    for (int dayIndex = 0; dayIndex < forecastSize; ++dayIndex) {
+        const WeatherData::Forecast &forecast = weather.forecasts[dayIndex];
         data.insert(QString("Short Forecast Day %1").arg(dayIndex), QString("%1|%2|%3|%4|%5|%6")
-                .arg(dayMap()[forecast.day.toLower()])
-                .arg(getWeatherIcon(forecastIcons(), forecast.icon))
-                .arg(forecastConditions().value(forecast.icon))
-                .arg(forecast.temperatureHigh)
-                .arg(forecast.temperatureLow)
+                .arg(forecast.day >= 1 && forecast.day <= 7 ? QDate::shortDayName(forecast.day, QDate::StandaloneFormat) : QString())
+                .arg(getWeatherIcon(conditionIcon(forecast.icon)))
+                .arg(conditionString(WeatherIcon::conditionText(forecast.icon)))
+                .arg(valueString(forecast.temperatureHigh))
+                .arg(valueString(forecast.temperatureLow))
                 .arg("N/U"));
-        dayIndex++;
     }
 
     // Set number of forecasts per day/night supported
-    data.insert("Total Weather Days", dayIndex);
+    data.insert("Total Weather Days", forecastSize);
+
+    // Hourly rows only go to sources asking for them
+    if (isHourlySource(source)) {
+        const int hourlySize = weather.hourlySize();
+        for (int i = 0; i < hourlySize; ++i) {
+            const WeatherData::Hourly &hour = weather.hourly.at(i);
+            data.insert(QString("Hourly Forecast %1").arg(i), QString("%1|%2|%3|%4|%5|%6|%7|%8")
+                    .arg(hour.date)
+                    .arg(hour.condition)
+                    .arg(valueString(hour.temperature))
+                    .arg(valueString(hour.pressure))
+                    .arg(windDirectionString(hour.windDirection))
+                    .arg(valueString(hour.windSpeed))
+                    .arg(valueString(hour.humidity))
+                    .arg(valueString(hour.comfortTemperature)));
+        }
+        data.insert("Total Hourly Forecasts", hourlySize);
+    }
+
+    // Age of the data, cached data is shown until fresh one is downloaded
+    data.insert("Update Time", weather.updated);
+    data.insert("Cached", cached);
+
+    if (isBatchSource(source)) {
+        publishCityData(source, code, data);
+        return;
+    }
 
     data.insert("Credit", i18n("Meteorological data is provided by Gismeteo"));
     data.insert("Credit Url", "http://www.gismeteo.ru/");
-    setData(source, data);
+    publishData(source, data);
 
-    kDebug() << data;
+    gismeteoTrace(Payload) << data;
 }
 
 void EnvGismeteoIon::validate(const QString& source)
 {
-    kDebug() << "validate()";
+    gismeteoTrace(Publish) << "validate()" << source;
 
-    if (!m_places.contains(source)) {
+    const CachedPlaces *cached = m_places.object(GismeteoPlaceIndex::normalize(source.section('|', 2, 2)));
+    if (!cached) {
         return;
     }
 
-    const QList<XMLMapInfo> &data = m_places[source];
+    validate(source, cached->places);
+}
 
+void EnvGismeteoIon::validate(const QString& source, const QList<XMLMapInfo>& data, bool suggestions)
+{
+    GismeteoStageTimer publishTimer(GismeteoStats::Publish);
     QString placeList;
     bool beginflag = true;
 
@@ -794,11 +1176,14 @@ void EnvGismeteoIon::validate(const QString& source)
             placeList.append(QString("|place|%1|extra|%2").arg(place.name).arg(place.id));
         }
     }
-    if (m_places.count() > 1) {
-        setData(source, "validate", QString("gismeteo|valid|multiple|place|%1").arg(placeList));
+    Plasma::DataEngine::Data reply;
+    // A guess is never taken as the answer, even if there is only one
+    if (data.count() > 1 || suggestions) {
+        reply.insert("validate", QString("gismeteo|valid|multiple|place|%1").arg(placeList));
     } else {
-        setData(source, "validate", QString("gismeteo|valid|single|place|%1").arg(placeList));
+        reply.insert("validate", QString("gismeteo|valid|single|place|%1").arg(placeList));
     }
+    publishData(source, reply);
 }
 
 #include "ion_gismeteo.moc"
@@ -27,38 +27,27 @@
 
 #include <QtXml/QXmlStreamReader>
 #include <QDateTime>
+#include <QSet>
 
 #include <kdemacros.h>
 #include <KIO/Job>
 #include <Plasma/DataEngine>
 #include <Plasma/Weather/Ion>
-
-class WeatherData
-{
-
-public:
-
-    // Current observation information.
-    QString date;
-    QString condition;
-    QString conditionIcon;
-    QString temperature;
-    QString pressure;
-    QString windDirection;
-    QString windSpeed;
-    QString humidity;
-    QString waterTemperature;
-
-    struct Forecast
-    {
-        QString day;
-        QString icon;
-        QString temperatureHigh;
-        QString temperatureLow;
-    };
-    QList<Forecast> forecasts;
-
-};
+#include <Solid/Networking>
+
+#include "gismeteo_cache.h"
+#include "gismeteo_catalogue.h"
+#include "gismeteo_chunkbuffer.h"
+#include "gismeteo_data.h"
+#include "gismeteo_diskcache.h"
+#include "gismeteo_placeindex.h"
+#include "gismeteo_querycache.h"
+#include "gismeteo_stats.h"
+
+class GismeteoFetchScheduler;
+class GismeteoParsePool;
+class GismeteoSectionScanner;
+class GismeteoStreamParser;
 
 class KDE_EXPORT EnvGismeteoIon : public IonInterface
 {
@@ -68,13 +57,13 @@ public:
     EnvGismeteoIon(QObject *parent, const QVariantList &args);
     ~EnvGismeteoIon();
     bool updateIonSource(const QString& source); // Sync data source with Applet
-    void updateWeather(const QString& source);
+    void updateWeather(const QString& source, const QString& code, bool cached = false);
     void validate(const QString& source);
 
-    struct XMLMapInfo {
-        QString name;
-        QString link;
-        int id;
+    // Validators of a downloaded page for conditional requests
+    struct HttpValidators {
+        QString etag;
+        QString lastModified;
     };
 
 public Q_SLOTS:
@@ -90,41 +79,130 @@ protected Q_SLOTS:
     void setup_slotDataArrived(KIO::Job *, const QByteArray &);
     void setup_slotJobFinished(KJob *);
 
+    void slotTotalSize(KJob *, qulonglong);
+
+    void slotQueryFileChanged(const QString &);
+
+    void slotWeatherParsed(const QString &code, const WeatherData &data, bool ok);
+    void slotSearchParsed(const QString &query, const QList<XMLMapInfo> &places, bool ok);
+
+    void slotFetchReady(const QString& id, const KUrl& url);
+    void slotNetworkStatusChanged(Solid::Networking::Status status);
+    void slotSourceRemoved(const QString& source);
+
 private:
     /* Gismeteo Methods - Internal for Ion */
     void deleteForecasts();
 
-    QMap<QString, ConditionIcons> setupConditionIconMappings(void) const;
-    QMap<QString, ConditionIcons> setupForecastIconMappings(void) const;
-    QMap<QString, QString> setupForecastConditionMappings(void) const;
-    QMap<QString, QString> setupDayMappings(void) const;
-    QMap<QString, WindDirections> setupWindIconMappings(void) const;
-
-    QMap<QString, ConditionIcons> const& conditionIcons(void) const;
-    QMap<QString, ConditionIcons> const& forecastIcons(void) const;
-    QMap<QString, QString> const& forecastConditions(void) const;
-    QMap<QString, QString> const& dayMap(void) const;
-    QMap<QString, WindDirections> const& windIcons(void) const;
-
     // Load and parse the specific place(s)
     void getWeather(const QString& code, const QString& source);
-    bool readHTMLData(const QString& source, const QByteArray& xml);
+    void getBatchWeather(const QString& source, const QStringList& codes);
+    void finishWeatherJob(KJob *job);
+    void publishWeather(const QString& code, bool cached = false);
+    void weatherFailed(const QString& code);
+    void weatherUnavailable(const QString& source, const QString& code);
+
+    // Publish only values that changed since last time
+    void publishData(const QString& source, const Plasma::DataEngine::Data& data,
+                     QStringList *ownedKeys = 0);
+    void publishCityData(const QString& source, const QString& code, const Plasma::DataEngine::Data& data);
 
     // Check if place specified is valid or not
     void findPlace(const QString& place, const QString& source);
-    bool readSearchHTMLData(const QString& source, const QByteArray& xml);
+    bool findPlaceLocally(const QString& query, const QString& source);
+    void publishPlaces(const QString& query);
+    void validate(const QString& source, const QList<XMLMapInfo>& places, bool suggestions = false);
+    bool suggestPlaces(const QString& source, const QString& query);
+
+    // Start downloads once scheduler lets them
+    void startWeatherJob(const QString& code, const KUrl& url);
+    void startSearchJob(const QString& query, const KUrl& url);
+
+    // Latency percentiles and counters for gismeteo|stats source
+    void publishStats(const QString& source);
+
+    // Locate installed XQuery file and watch it for changes
+    QString queryFile(const QString& name);
+
+    // Parsed pages are cached along with their validators, so both are
+    // evicted together
+    struct CachedWeather {
+        WeatherData data;
+        HttpValidators validators;
+    };
+    struct CachedPlaces {
+        QList<XMLMapInfo> places;
+        HttpValidators validators;
+    };
 
-    // Weather information
-    QHash<QString, WeatherData> m_weatherData;
-    QHash<QString, QList<EnvGismeteoIon::XMLMapInfo> > m_places;
+    // Weather information by city code and search results by normalized query
+    GismeteoCache<QString, CachedWeather> m_weatherData;
+    GismeteoCache<QString, CachedPlaces> m_places;
+    GismeteoPlaceIndex m_placeIndex;
+    GismeteoCatalogue m_catalogue;
+    GismeteoDiskCache m_diskCache;
 
     // Store KIO jobs
-    QHash<KJob *, QByteArray> m_jobXml;
-    QHash<KJob *, QString> m_jobList;
+    struct WeatherJob {
+        QString code;
+        GismeteoChunkBuffer html;           // page for XQuery backend
+        GismeteoStreamParser *parser;       // stream backend
+        GismeteoSectionScanner *scanner;    // early termination for XQuery backend
+        qint64 parseNsecs;                  // time spent in stream parser
+        bool hourly;                        // hourly rows are parsed too
+        bool conditional;                   // validators were sent
+    };
+    QHash<KJob *, WeatherJob> m_jobs;
+
+    // Sources waiting for weather by city code, a city is being
+    // downloaded or parsed while it is here
+    QHash<QString, QStringList> m_waitingSources;
 
-    QHash<KJob *, QByteArray> m_searchJobXml;
-    QHash<KJob *, QString> m_searchJobList;
+    // Cities with hourly sources, only their pages get the hourly table parsed
+    QSet<QString> m_hourlyCodes;
+
+    // Keys published for each city of batch sources, by source and code
+    QHash<QString, QHash<QString, QStringList> > m_batchKeys;
+
+    // Validators of pages being parsed by fetch id, they go to the cache
+    // with the parsed values
+    QHash<QString, HttpValidators> m_parseValidators;
+
+    struct SearchJob {
+        QString query;
+        GismeteoChunkBuffer html;
+        bool conditional;                   // validators were sent
+    };
+    QHash<KJob *, SearchJob> m_searchJobs;
 
+    // Connect and transfer timing of weather and search downloads
+    QHash<KJob *, GismeteoTransferTimer> m_transfers;
+
+    // Sources waiting for search results by normalized query
+    QHash<QString, QStringList> m_searchWaitingSources;
+
+    // Site to download pages from, ends with a slash
+    QString m_baseUrl;
+
+    // Compiled XQuery programs
+    GismeteoQueryCache m_queryCache;
+    QHash<QString, QString> m_queryFiles;
+
+    // Parses downloaded pages, in place as data arrives or in worker threads
+    bool m_useStreamParser;
+    bool m_earlyTermination;
+    GismeteoParsePool *m_parsePool;
+
+    // Limits and orders downloads
+    GismeteoFetchScheduler *m_scheduler;
+
+    // Cities failed to download or parse, retried after a growing delay
+    struct Backoff {
+        Backoff() : failures(0), retryAt(0) {}
+        int failures;
+        qint64 retryAt;     // ms since epoch
+    };
+    QHash<QString, Backoff> m_backoff;
 
 };
 
@@ -34,7 +34,9 @@ make install DESTDIR=$RPM_BUILD_ROOT
 %doc CHANGELOG COPYING README
 %{_libdir}/kde4/ion_%{ion_name}.so
 %{_datadir}/kde4/apps/plasma-ion-%{ion_name}/%{ion_name}.xq
+%{_datadir}/kde4/apps/plasma-ion-%{ion_name}/%{ion_name}-hourly.xq
 %{_datadir}/kde4/apps/plasma-ion-%{ion_name}/%{ion_name}-search.xq
+%{_datadir}/kde4/apps/plasma-ion-%{ion_name}/%{ion_name}-cities.txt
 %{_datadir}/kde4/services/ion-%{ion_name}.desktop
 
 